@@ -1,14 +1,23 @@
 /* Implementation of simple command-line interface */
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "console.h"
@@ -20,6 +29,23 @@ int simulation = 0;
 int show_entropy = 0;
 static cmd_element_t *cmd_list = NULL;
 static param_element_t *param_list = NULL;
+
+/* Commands and parameters are also found by name in open-addressing hash
+ * tables, filled as they are added.  Kept at most half full.
+ */
+#define LOOKUP_SLOTS 256 /* Power of 2 */
+
+typedef struct {
+    const char *name;
+    void *entry;
+} lookup_slot_t;
+
+static lookup_slot_t cmd_table[LOOKUP_SLOTS];
+static lookup_slot_t param_table[LOOKUP_SLOTS];
+static int cmd_count = 0, param_count = 0;
+
+/* Most words a command line is split into */
+#define MAX_ARGC 256
 static bool block_flag = false;
 static bool prompt_flag = true;
 
@@ -65,6 +91,16 @@ static bool has_infile = false;
 static cmd_func_t quit_helpers[MAXQUIT];
 static int quit_helper_cnt = 0;
 
+static cmd_func_t pre_cmd_helper = NULL;
+
+/* Process running the commands once a checkpoint is restored, -1 if it died,
+ * 0 while they run here.  See do_checkpoint().
+ */
+static pid_t engine_pid = 0;
+
+static bool runs_in_front(const char *name);
+static bool forward_cmd(int argc, char *argv[]);
+
 static void init_in();
 
 static bool push_file(char *fname);
@@ -72,6 +108,50 @@ static void pop_file();
 
 static bool interpret_cmda(int argc, char *argv[]);
 
+/* FNV-1a */
+static uint32_t name_hash(const char *name)
+{
+    uint32_t h = 2166136261u;
+    for (; *name; name++)
+        h = (h ^ (unsigned char) *name) * 16777619u;
+    return h;
+}
+
+/* Slot of @table holding @name, or the empty one where it would go */
+static lookup_slot_t *lookup(lookup_slot_t *table, const char *name)
+{
+    for (uint32_t i = name_hash(name);; i++) {
+        lookup_slot_t *slot = &table[i & (LOOKUP_SLOTS - 1)];
+        if (!slot->name || !strcmp(slot->name, name))
+            return slot;
+    }
+}
+
+/* Enter @entry under @name, replacing any earlier one as the lists do */
+static void lookup_add(lookup_slot_t *table,
+                       int *count,
+                       const char *name,
+                       void *entry)
+{
+    lookup_slot_t *slot = lookup(table, name);
+    if (!slot->name) {
+        if (*count >= LOOKUP_SLOTS / 2) {
+            report_event(MSG_FATAL, "Too many commands or parameters");
+            return;
+        }
+        (*count)++;
+    }
+    slot->name = name;
+    slot->entry = entry;
+}
+
+static void lookup_clear()
+{
+    memset(cmd_table, 0, sizeof(cmd_table));
+    memset(param_table, 0, sizeof(param_table));
+    cmd_count = param_count = 0;
+}
+
 /* Add a new command */
 void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
 {
@@ -89,10 +169,16 @@ void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
     cmd->param = param;
     cmd->next = next_cmd;
     *last_loc = cmd;
+    lookup_add(cmd_table, &cmd_count, name, cmd);
 }
 
-/* Add a new parameter */
-void add_param(char *name, int *valp, char *summary, setter_func_t setter)
+static param_element_t *new_param(char *name,
+                                  int *valp,
+                                  const char *const *names,
+                                  int min,
+                                  int max,
+                                  char *summary,
+                                  setter_func_t setter)
 {
     param_element_t *next_param = param_list;
     param_element_t **last_loc = &param_list;
@@ -106,56 +192,68 @@ void add_param(char *name, int *valp, char *summary, setter_func_t setter)
     param->name = name;
     param->valp = valp;
     param->summary = summary;
+    param->names = names;
+    param->min = min;
+    param->max = max;
     param->setter = setter;
     param->next = next_param;
     *last_loc = param;
+    lookup_add(param_table, &param_count, name, param);
+    return param;
 }
 
-/* Parse a string into a command line */
-static char **parse_args(char *line, int *argcp)
+/* Add a new parameter */
+void add_param(char *name, int *valp, char *summary, setter_func_t setter)
 {
-    /* Must first determine how many arguments there are.
-     * Replace all white space with null characters
-     */
-    size_t len = strlen(line);
+    new_param(name, valp, NULL, INT_MIN, INT_MAX, summary, setter);
+}
 
-    /* First copy into buffer with each substring null-terminated */
-    char *buf = malloc_or_fail(len + 1, "parse_args");
-    buf[len] = '\0';
+/* Add a new parameter whose values can also be given by name */
+void add_param_named(char *name,
+                     int *valp,
+                     const char *const *names,
+                     char *summary,
+                     setter_func_t setter)
+{
+    int cnt = 0;
+    while (names[cnt])
+        cnt++;
+    new_param(name, valp, names, 0, cnt - 1, summary, setter);
+}
 
-    char *src = line;
-    char *dst = buf;
-    bool skipping = true;
-    int c;
-    int argc = 0;
-    while ((c = *src++) != '\0') {
-        if (isspace(c)) {
-            if (!skipping) {
-                /* Hit end of word */
-                *dst++ = '\0';
-                skipping = true;
-            }
-        } else {
-            if (skipping) {
-                /* Hit start of new word */
-                argc++;
-                skipping = false;
-            }
-            *dst++ = c;
-        }
-    }
+/* Add a new parameter that only takes values from @min to @max */
+void add_param_range(char *name,
+                     int *valp,
+                     int min,
+                     int max,
+                     char *summary,
+                     setter_func_t setter)
+{
+    new_param(name, valp, NULL, min, max, summary, setter);
+}
 
-    /* Now assemble into array of strings */
-    char **argv = calloc_or_fail(argc, sizeof(char *), "parse_args");
-    src = buf;
-    for (int i = 0; i < argc; i++) {
-        argv[i] = strsave_or_fail(src, "parse_args");
-        src += strlen(argv[i]) + 1;
+/* Split @line in place into at most @max words, stored in @argv.
+ * Return: the number of words, -1 if there are more
+ */
+static int parse_args(char *line, char *argv[], int max)
+{
+    int argc = 0;
+    char *p = line;
+    while (true) {
+        while (isspace((unsigned char) *p))
+            p++;
+        if (!*p)
+            break;
+        if (argc == max)
+            return -1;
+        argv[argc++] = p;
+        while (*p && !isspace((unsigned char) *p))
+            p++;
+        if (!*p)
+            break;
+        *p++ = '\0';
     }
-
-    free_block(buf, len + 1);
-    *argcp = argc;
-    return argv;
+    return argc;
 }
 
 static void record_error()
@@ -167,18 +265,34 @@ static void record_error()
     }
 }
 
-/* Execute a command that has already been split into arguments */
-static bool interpret_cmda(int argc, char *argv[])
+static cmd_element_t *find_cmd(const char *name)
+{
+    return lookup(cmd_table, name)->entry;
+}
+
+static param_element_t *find_param(const char *name)
+{
+    return lookup(param_table, name)->entry;
+}
+
+/* Run @cmd in this process, without counting errors */
+static bool exec_cmd(cmd_element_t *cmd, int argc, char *argv[])
 {
-    if (argc == 0)
-        return true;
-    /* Try to find matching command */
-    cmd_element_t *next_cmd = cmd_list;
     bool ok = true;
-    while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
-        next_cmd = next_cmd->next;
-    if (next_cmd) {
-        ok = next_cmd->operation(argc, argv);
+    if (pre_cmd_helper)
+        ok = pre_cmd_helper(argc, argv);
+    return cmd->operation(argc, argv) && ok;
+}
+
+/* Run @cmd with its arguments, or report argv[0] unknown if @cmd is NULL */
+static bool run_cmd(cmd_element_t *cmd, int argc, char *argv[])
+{
+    bool ok = true;
+    if (cmd) {
+        if (engine_pid && !runs_in_front(cmd->name))
+            ok = forward_cmd(argc, argv);
+        else
+            ok = exec_cmd(cmd, argc, argv);
         if (!ok)
             record_error();
     } else {
@@ -190,20 +304,28 @@ static bool interpret_cmda(int argc, char *argv[])
     return ok;
 }
 
-/* Execute a command from a command line */
+/* Execute a command that has already been split into arguments */
+static bool interpret_cmda(int argc, char *argv[])
+{
+    if (argc == 0)
+        return true;
+    return run_cmd(find_cmd(argv[0]), argc, argv);
+}
+
+/* Execute a command from a command line, which is split up in place */
 static bool interpret_cmd(char *cmdline)
 {
     if (quit_flag)
         return false;
 
-    int argc;
-    char **argv = parse_args(cmdline, &argc);
-    bool ok = interpret_cmda(argc, argv);
-    for (int i = 0; i < argc; i++)
-        free_string(argv[i]);
-    free_array(argv, argc, sizeof(char *));
-
-    return ok;
+    char *argv[MAX_ARGC];
+    int argc = parse_args(cmdline, argv, MAX_ARGC);
+    if (argc < 0) {
+        report(1, "Too many arguments, at most %d", MAX_ARGC);
+        record_error();
+        return false;
+    }
+    return interpret_cmda(argc, argv);
 }
 
 /* Set function to be executed as part of program exit */
@@ -215,17 +337,34 @@ void add_quit_helper(cmd_func_t qf)
         report_event(MSG_FATAL, "Exceeded limit on quit helpers");
 }
 
+void set_pre_cmd_helper(cmd_func_t hf)
+{
+    pre_cmd_helper = hf;
+}
+
 /* Turn echoing on/off */
 void set_echo(bool on)
 {
     echo = on ? 1 : 0;
 }
 
+static void release_checkpoint();
+
 /* Built-in commands */
 static bool do_quit(int argc, char *argv[])
 {
     cmd_element_t *c = cmd_list;
     bool ok = true;
+    /* The state of the session lives in the engine, so that it has to free
+     * it and check for leaks; what is left here is out of date.
+     */
+    bool run_helpers = !engine_pid;
+    if (engine_pid) {
+        char *quit_argv[] = {"quit"};
+        ok = forward_cmd(1, quit_argv);
+    }
+    release_checkpoint();
+
     while (c) {
         cmd_element_t *ele = c;
         c = c->next;
@@ -238,11 +377,12 @@ static bool do_quit(int argc, char *argv[])
         p = p->next;
         free_block(ele, sizeof(param_element_t));
     }
+    lookup_clear();
 
     while (buf_stack)
         pop_file();
 
-    for (int i = 0; i < quit_helper_cnt; i++) {
+    for (int i = 0; run_helpers && i < quit_helper_cnt; i++) {
         ok = ok && quit_helpers[i](argc, argv);
     }
 
@@ -250,6 +390,32 @@ static bool do_quit(int argc, char *argv[])
     return ok;
 }
 
+/* Number of names attached to parameter, 0 if it is plain integer */
+static int param_name_count(const param_element_t *param)
+{
+    int cnt = 0;
+    if (param->names) {
+        while (param->names[cnt])
+            cnt++;
+    }
+    return cnt;
+}
+
+static void show_params()
+{
+    param_element_t *plist = param_list;
+    report(1, "Options:");
+    while (plist) {
+        int val = *plist->valp;
+        if (val >= 0 && val < param_name_count(plist))
+            report(1, "  %-12s%-12s | %s", plist->name, plist->names[val],
+                   plist->summary);
+        else
+            report(1, "  %-12s%-12d | %s", plist->name, val, plist->summary);
+        plist = plist->next;
+    }
+}
+
 static bool do_help(int argc, char *argv[])
 {
     cmd_element_t *clist = cmd_list;
@@ -259,13 +425,7 @@ static bool do_help(int argc, char *argv[])
                clist->summary);
         clist = clist->next;
     }
-    param_element_t *plist = param_list;
-    report(1, "Options:");
-    while (plist) {
-        report(1, "  %-12s%-12d | %s", plist->name, *plist->valp,
-               plist->summary);
-        plist = plist->next;
-    }
+    show_params();
     return true;
 }
 
@@ -286,60 +446,99 @@ static bool do_comment_cmd(int argc, char *argv[])
 /* Extract integer from text and store at loc */
 bool get_int(char *vname, int *loc)
 {
-    char *end = NULL;
-    long int v = strtol(vname, &end, 0);
-    if (v == LONG_MIN || *end != '\0')
+    int64_t v;
+    if (!get_int64(vname, &v) || v < INT_MIN || v > INT_MAX)
         return false;
 
     *loc = (int) v;
     return true;
 }
 
+/* Extract 64-bit integer from text and store at loc */
+bool get_int64(char *vname, int64_t *loc)
+{
+    char *end = NULL;
+    errno = 0;
+    long long v = strtoll(vname, &end, 0);
+    if (errno || end == vname || *end != '\0')
+        return false;
+
+    *loc = (int64_t) v;
+    return true;
+}
+
+/* Extract parameter value from integer or value name.  A number outside
+ * the range of the parameter is reported here; the caller only reports text
+ * which is neither a number nor a name.
+ */
+static bool get_param_value(const param_element_t *param,
+                            char *text,
+                            int *loc,
+                            bool *out_of_range)
+{
+    int v;
+    *out_of_range = false;
+    if (get_int(text, &v)) {
+        if (v < param->min || v > param->max) {
+            *out_of_range = true;
+            return false;
+        }
+        *loc = v;
+        return true;
+    }
+
+    int cnt = param_name_count(param);
+    for (int i = 0; i < cnt; i++) {
+        if (strcmp(text, param->names[i]) == 0) {
+            *loc = i;
+            return true;
+        }
+    }
+    return false;
+}
+
 static bool do_option(int argc, char *argv[])
 {
     if (argc == 1) {
-        param_element_t *plist = param_list;
-        report(1, "Options:");
-        while (plist) {
-            report(1, "  %-12s%-12d | %s", plist->name, *plist->valp,
-                   plist->summary);
-            plist = plist->next;
-        }
+        show_params();
         return true;
     }
 
     for (int i = 1; i < argc; i++) {
         char *name = argv[i];
         int value = 0;
-        bool found = false;
         /* Get value from next argument */
         if (i + 1 >= argc) {
             report(1, "No value given for parameter %s", name);
             return false;
-        } else if (!get_int(argv[++i], &value)) {
-            report(1, "Cannot parse '%s' as integer", argv[i]);
-            return false;
         }
-        /* Find parameter in list */
-        param_element_t *plist = param_list;
-        while (!found && plist) {
-            if (strcmp(plist->name, name) == 0) {
-                int oldval = *plist->valp;
-                *plist->valp = value;
-                if (plist->setter)
-                    plist->setter(oldval);
-                found = true;
-            } else
-                plist = plist->next;
-        }
-        /* Didn't find parameter */
-        if (!found) {
+        char *text = argv[++i];
+        param_element_t *param = find_param(name);
+        if (!param) {
             report(1, "Unknown parameter '%s'", name);
             return false;
         }
+        bool out_of_range;
+        if (!get_param_value(param, text, &value, &out_of_range)) {
+            if (out_of_range && param->max == INT_MAX)
+                report(1, "Value of %s must be at least %d", name,
+                       param->min);
+            else if (out_of_range)
+                report(1, "Value of %s must be between %d and %d", name,
+                       param->min, param->max);
+            else
+                report(1, "Cannot parse '%s' as %s", text,
+                       param->names ? "value of parameter" : "integer");
+            return false;
+        }
+        int oldval = *param->valp;
+        *param->valp = value;
+        if (param->setter)
+            param->setter(oldval);
     }
 
-    return true;
+    /* Kept here too, for the parameters of the console itself */
+    return !engine_pid || forward_cmd(argc, argv);
 }
 
 static bool do_source(int argc, char *argv[])
@@ -391,6 +590,103 @@ static bool do_time(int argc, char *argv[])
     return ok;
 }
 
+/* Print bench results as CSV rows rather than text */
+static int bench_csv = 0;
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Latency below which a fraction @q of the sorted @lat falls */
+static uint64_t percentile(const uint64_t *lat, int n, double q)
+{
+    int i = (int) (q * n + 0.999999) - 1;
+    return lat[i < 0 ? 0 : i];
+}
+
+static bool do_bench(int argc, char *argv[])
+{
+    int iters = 100, warmup = 10;
+    int first = 1;
+    while (first + 1 < argc && argv[first][0] == '-') {
+        int *loc = !strcmp(argv[first], "-n")   ? &iters
+                   : !strcmp(argv[first], "-w") ? &warmup
+                                                : NULL;
+        if (!loc || !get_int(argv[first + 1], loc)) {
+            report(1, "Invalid bench argument '%s %s'", argv[first],
+                   argv[first + 1]);
+            return false;
+        }
+        first += 2;
+    }
+    if (first >= argc || iters < 1 || warmup < 0) {
+        report(1, "Usage: bench [-n iterations] [-w warmup] cmd arg ...");
+        return false;
+    }
+
+    uint64_t *lat = malloc_or_fail(sizeof(uint64_t) * iters, "do_bench");
+    /* Keep errors, but not the queue shown after each run */
+    int saved_verblevel = verblevel;
+    if (verblevel > 1)
+        set_verblevel(1);
+
+    bool ok = true;
+    int runs = 0;
+    for (int i = 0; ok && i < warmup; i++)
+        ok = interpret_cmda(argc - first, argv + first);
+    uint64_t total = 0;
+    for (; ok && runs < iters; runs++) {
+        uint64_t start = now_ns();
+        ok = interpret_cmda(argc - first, argv + first);
+        lat[runs] = now_ns() - start;
+        total += lat[runs];
+    }
+    set_verblevel(saved_verblevel);
+
+    if (!ok) {
+        report(1, "bench stopped by a failure after %d runs", runs);
+    } else {
+        qsort(lat, runs, sizeof(uint64_t), cmp_u64);
+        double ops = total ? runs * 1e9 / total : 0;
+        uint64_t p50 = percentile(lat, runs, 0.5);
+        uint64_t p90 = percentile(lat, runs, 0.9);
+        uint64_t p99 = percentile(lat, runs, 0.99);
+        if (bench_csv) {
+            static bool header = false;
+            if (!header) {
+                report(1, "cmd,runs,ops_per_sec,min_ns,p50_ns,p90_ns,p99_ns,"
+                          "max_ns");
+                header = true;
+            }
+            report_noreturn(1, "\"%s", argv[first]);
+            for (int i = first + 1; i < argc; i++)
+                report_noreturn(1, " %s", argv[i]);
+            report(1,
+                   "\",%d,%.1f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+                   ",%" PRIu64,
+                   runs, ops, lat[0], p50, p90, p99, lat[runs - 1]);
+        } else {
+            report(1, "%d runs, %.1f ops/s", runs, ops);
+            report(1,
+                   "Latency ns: min %" PRIu64 "  p50 %" PRIu64 "  p90 %" PRIu64
+                   "  p99 %" PRIu64 "  max %" PRIu64,
+                   lat[0], p50, p90, p99, lat[runs - 1]);
+        }
+    }
+
+    free_array(lat, iters, sizeof(uint64_t));
+    return ok;
+}
+
 static bool use_linenoise = true;
 static int web_fd;
 
@@ -413,11 +709,310 @@ static bool do_web(int argc, char *argv[])
     return true;
 }
 
+/* Checkpoints.  'checkpoint' forks a holder, which keeps a copy-on-write
+ * image of the process and sleeps until asked to fork it again.  'restore'
+ * has the holder fork a fresh engine off that image, and from then on the
+ * commands read here are sent to the engine to run.  This process goes on
+ * reading input, so that files, nested sources and the web port behave as
+ * before, and times commands including the round trip; 'bench' runs in the
+ * engine, to measure latency without it.  A checkpoint taken while an
+ * engine runs is made by the engine, since it holds the state of the session.
+ *
+ * Three pipes are shared by all of them: commands go to the engine, replies
+ * come back, and a byte to the holder asks it to fork a new engine.  Only
+ * this process keeps the write ends of the first and last, so that holders
+ * and engines see end of file once it exits.
+ */
+typedef struct {
+    int32_t ok;
+    int32_t pid; /* Engine when it starts, holder made by 'checkpoint' */
+} engine_reply_t;
+
+static pid_t holder_pid = 0; /* Holder of the latest checkpoint */
+static bool in_engine = false;
+static pid_t new_holder = 0; /* In an engine, made by the last command */
+
+/* Ends kept by this process, and the ends inherited by holders and engines */
+static int cmd_out = -1, reply_in = -1, fork_out = -1;
+static int cmd_in = -1, reply_out = -1, fork_in = -1;
+
+static bool runs_in_front(const char *name)
+{
+    static const char *const front_cmds[] = {
+        "help", "option", "quit", "restore", "source", "time", "web", NULL,
+    };
+    for (int i = 0; front_cmds[i]; i++) {
+        if (!strcmp(name, front_cmds[i]))
+            return true;
+    }
+    return false;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void close_fd(int *fd)
+{
+    if (*fd >= 0)
+        close(*fd);
+    *fd = -1;
+}
+
+/* Holders and engines are reaped as soon as they exit, by their parent
+ * ignoring SIGCHLD or by init, except the holders forked here.
+ */
+static bool process_alive(pid_t pid)
+{
+    if (waitpid(pid, NULL, WNOHANG) == pid)
+        return false;
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+/* Wait for a reply, which @peer sends unless it dies first */
+static bool wait_reply(pid_t peer, engine_reply_t *r)
+{
+    struct pollfd p = {.fd = reply_in, .events = POLLIN};
+    while (true) {
+        int n = poll(&p, 1, 100);
+        if (n > 0)
+            return read_all(reply_in, r, sizeof(*r));
+        if (n < 0 && errno != EINTR)
+            return false;
+        if (n == 0 && !process_alive(peer))
+            return false;
+    }
+}
+
+/* Have the engine run a command and wait until it is done */
+static bool forward_cmd(int argc, char *argv[])
+{
+    if (engine_pid < 0) {
+        report(1, "ERROR: Engine is gone, restore a checkpoint first");
+        return false;
+    }
+
+    fflush(stdout);
+    uint32_t n = argc;
+    bool ok = write_all(cmd_out, &n, sizeof(n));
+    for (int i = 0; ok && i < argc; i++) {
+        uint32_t len = strlen(argv[i]);
+        ok = write_all(cmd_out, &len, sizeof(len)) &&
+             write_all(cmd_out, argv[i], len);
+    }
+
+    engine_reply_t r;
+    if (!ok || !wait_reply(engine_pid, &r)) {
+        report(1, "ERROR: Engine process %d is gone", engine_pid);
+        engine_pid = -1;
+        return false;
+    }
+    if (r.pid > 0) {
+        /* The engine took a checkpoint, which replaces ours */
+        if (holder_pid > 0) {
+            kill(holder_pid, SIGKILL);
+            waitpid(holder_pid, NULL, 0);
+        }
+        holder_pid = r.pid;
+    }
+    return r.ok;
+}
+
+/* Run the commands sent by the front until told to stop */
+static void serve_engine()
+{
+    in_engine = true;
+    engine_reply_t r = {.ok = true, .pid = getpid()};
+    if (!write_all(reply_out, &r, sizeof(r)))
+        _exit(EXIT_FAILURE);
+
+    uint32_t argc;
+    while (read_all(cmd_in, &argc, sizeof(argc))) {
+        char **argv = calloc_or_fail(argc + 1, sizeof(char *), "serve_engine");
+        bool ok = true;
+        for (uint32_t i = 0; ok && i < argc; i++) {
+            uint32_t len;
+            ok = read_all(cmd_in, &len, sizeof(len)) && len < RIO_BUFSIZE;
+            if (ok) {
+                argv[i] = malloc_or_fail(len + 1, "serve_engine");
+                ok = read_all(cmd_in, argv[i], len);
+                argv[i][len] = '\0';
+            }
+        }
+        if (!ok)
+            _exit(EXIT_FAILURE);
+
+        /* No arguments asks the engine to stop, as before a restore */
+        bool stop = !argc || !strcmp(argv[0], "quit");
+        new_holder = 0;
+        r.ok = !argc || exec_cmd(find_cmd(argv[0]), argc, argv);
+        r.pid = new_holder;
+        fflush(stdout);
+        for (uint32_t i = 0; i < argc; i++)
+            free_string(argv[i]);
+        free_array(argv, argc + 1, sizeof(char *));
+        if (!write_all(reply_out, &r, sizeof(r)) || stop)
+            break;
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+/* Sleep until asked for an engine, which starts from this very image */
+static void hold_checkpoint()
+{
+    char c;
+    while (read(fork_in, &c, 1) == 1) {
+        pid_t pid = fork();
+        if (pid == 0)
+            serve_engine();
+        if (pid < 0) {
+            engine_reply_t r = {.ok = false, .pid = 0};
+            write_all(reply_out, &r, sizeof(r));
+        }
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+/* Drop the current checkpoint and the engine, if any */
+static void release_checkpoint()
+{
+    if (holder_pid > 0) {
+        kill(holder_pid, SIGKILL);
+        waitpid(holder_pid, NULL, 0);
+    }
+    holder_pid = 0;
+    /* Engines see end of file and exit */
+    engine_pid = 0;
+    close_fd(&cmd_out);
+    close_fd(&reply_in);
+    close_fd(&fork_out);
+}
+
+static bool open_channel()
+{
+    int fds[3][2];
+    for (int i = 0; i < 3; i++) {
+        if (pipe(fds[i]) < 0) {
+            report(1, "ERROR: Could not create pipe: %s", strerror(errno));
+            while (i-- > 0) {
+                close(fds[i][0]);
+                close(fds[i][1]);
+            }
+            return false;
+        }
+    }
+    release_checkpoint();
+    cmd_in = fds[0][0], cmd_out = fds[0][1];
+    reply_in = fds[1][0], reply_out = fds[1][1];
+    fork_in = fds[2][0], fork_out = fds[2][1];
+    return true;
+}
+
+static bool do_checkpoint(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    /* An engine keeps using the channel it was started with */
+    if (!in_engine && !open_channel())
+        return false;
+
+    /* Output still buffered would be printed again by every engine */
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        report(1, "ERROR: Could not fork: %s", strerror(errno));
+        return false;
+    }
+    if (pid == 0) {
+        close_fd(&cmd_out);
+        close_fd(&reply_in);
+        close_fd(&fork_out);
+        signal(SIGCHLD, SIG_IGN);
+        hold_checkpoint();
+    }
+
+    if (in_engine) {
+        new_holder = pid;
+    } else {
+        holder_pid = pid;
+        close_fd(&cmd_in);
+        close_fd(&reply_out);
+        close_fd(&fork_in);
+    }
+    report(3, "Checkpoint held by process %d", pid);
+    return true;
+}
+
+static bool do_restore(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    if (in_engine) {
+        report(1, "ERROR: %s cannot be run by another command", argv[0]);
+        return false;
+    }
+    if (!holder_pid) {
+        report(1, "ERROR: No checkpoint to restore");
+        return false;
+    }
+
+    /* Wait for the engine to stop, so that it reads no more commands */
+    if (engine_pid > 0) {
+        uint32_t stop = 0;
+        engine_reply_t r;
+        if (write_all(cmd_out, &stop, sizeof(stop)))
+            wait_reply(engine_pid, &r);
+    }
+
+    fflush(stdout);
+    char c = 'f';
+    engine_reply_t r;
+    if (!write_all(fork_out, &c, 1) || !wait_reply(holder_pid, &r) || !r.ok) {
+        report(1, "ERROR: Could not start an engine from the checkpoint");
+        engine_pid = -1;
+        return false;
+    }
+    engine_pid = r.pid;
+    report(3, "Checkpoint restored in process %d", engine_pid);
+    return true;
+}
+
 /* Initialize interpreter */
 void init_cmd()
 {
     cmd_list = NULL;
     param_list = NULL;
+    lookup_clear();
     err_cnt = 0;
     quit_flag = false;
 
@@ -429,13 +1024,20 @@ void init_cmd()
     ADD_COMMAND(source, "Read commands from source file", "");
     ADD_COMMAND(log, "Copy output to file", "file");
     ADD_COMMAND(time, "Time command execution", "cmd arg ...");
+    ADD_COMMAND(bench, "Run command repeatedly, report throughput and latency",
+                "[-n N] [-w W] cmd arg ...");
     ADD_COMMAND(web, "Read commands from builtin web server", "[port]");
+    ADD_COMMAND(checkpoint, "Keep a copy of the current state to restore",
+                "");
+    ADD_COMMAND(restore, "Continue from a fresh copy of the last checkpoint",
+                "");
     add_cmd("#", do_comment_cmd, "Display comment", "...");
     add_param("simulation", &simulation, "Start/Stop simulation mode", NULL);
     add_param("verbose", &verblevel, "Verbosity level", NULL);
     add_param("error", &err_limit, "Number of errors until exit", NULL);
     add_param("echo", &echo, "Do/don't echo commands", NULL);
     add_param("entropy", &show_entropy, "Show/Hide Shannon entropy", NULL);
+    add_param("benchcsv", &bench_csv, "Print bench results as CSV", NULL);
 
     init_in();
     init_time(&last_time);
@@ -678,8 +1280,235 @@ void completion(const char *buf, line_completions_t *lc)
     }
 }
 
+/* Compiled traces hold the commands of a text trace resolved to opcodes,
+ * with their arguments split and NUL-terminated, so that replaying one needs
+ * no line reading, parsing or command lookup.  In host byte order:
+ *
+ *   magic     TRACE_MAGIC
+ *   u32       number of command names
+ *   u32       largest argc of a command
+ *   names     u16 length, then the bytes and a NUL, for every name; the
+ *             opcode of a command is the index of its name
+ *   commands  u16 opcode and u16 argc, then u16 length, the bytes and a NUL
+ *             for each of the argc - 1 arguments
+ *
+ * Names are resolved when the trace is loaded, so a name unknown to qtest
+ * fails when its command is replayed, as it does in a text trace.
+ */
+#define TRACE_MAGIC "QTRACE1\n"
+#define TRACE_MAGIC_LEN 8
+#define MAX_OPCODES 1024
+
+static void put_u16(FILE *f, uint16_t v)
+{
+    fwrite(&v, sizeof(v), 1, f);
+}
+
+static void put_u32(FILE *f, uint32_t v)
+{
+    fwrite(&v, sizeof(v), 1, f);
+}
+
+bool compile_trace(char *infile_name, char *outfile_name)
+{
+    FILE *in = fopen(infile_name, "r");
+    if (!in) {
+        report(1, "ERROR: Could not open source file '%s'", infile_name);
+        return false;
+    }
+
+    char *names[MAX_OPCODES];
+    int n_names = 0, max_argc = 1, lineno = 0;
+    char *records = NULL;
+    size_t records_size = 0;
+    FILE *rec = open_memstream(&records, &records_size);
+    bool ok = rec != NULL;
+
+    char *line = NULL;
+    size_t cap = 0;
+    while (ok && getline(&line, &cap, in) >= 0) {
+        char *argv[MAX_ARGC];
+        int argc = parse_args(line, argv, MAX_ARGC);
+        lineno++;
+
+        int op = 0;
+        while (argc > 0 && op < n_names && strcmp(names[op], argv[0]))
+            op++;
+        if (!argc) {
+            /* Blank line */
+        } else if (argc < 0 || op == MAX_OPCODES) {
+            report(1, "ERROR: %s:%d: too many arguments or commands",
+                   infile_name, lineno);
+            ok = false;
+        } else {
+            if (op == n_names)
+                names[n_names++] = strsave_or_fail(argv[0], "compile_trace");
+            if (argc > max_argc)
+                max_argc = argc;
+            put_u16(rec, op);
+            put_u16(rec, argc);
+            for (int i = 1; ok && i < argc; i++) {
+                size_t len = strlen(argv[i]);
+                ok = len <= UINT16_MAX;
+                put_u16(rec, len);
+                fwrite(argv[i], 1, len + 1, rec);
+            }
+        }
+    }
+    free(line);
+    fclose(in);
+    if (rec)
+        fclose(rec);
+
+    FILE *out = ok ? fopen(outfile_name, "wb") : NULL;
+    if (out) {
+        fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LEN, out);
+        put_u32(out, n_names);
+        put_u32(out, max_argc);
+        for (int i = 0; i < n_names; i++) {
+            size_t len = strlen(names[i]);
+            put_u16(out, len);
+            fwrite(names[i], 1, len + 1, out);
+        }
+        fwrite(records, 1, records_size, out);
+        ok = !ferror(out);
+        ok = !fclose(out) && ok;
+    }
+    if (ok)
+        report(1, "Compiled %d lines of '%s', %d distinct commands", lineno,
+               infile_name, n_names);
+    else
+        report(1, "ERROR: Could not compile '%s' to '%s'", infile_name,
+               outfile_name);
+
+    for (int i = 0; i < n_names; i++)
+        free_string(names[i]);
+    free(records);
+    return ok;
+}
+
+/* Cursor over a compiled trace */
+typedef struct {
+    char *p, *end;
+} trace_cursor_t;
+
+static bool get_u16(trace_cursor_t *c, uint16_t *v)
+{
+    if (c->end - c->p < (ptrdiff_t) sizeof(*v))
+        return false;
+    memcpy(v, c->p, sizeof(*v));
+    c->p += sizeof(*v);
+    return true;
+}
+
+static bool get_u32(trace_cursor_t *c, uint32_t *v)
+{
+    if (c->end - c->p < (ptrdiff_t) sizeof(*v))
+        return false;
+    memcpy(v, c->p, sizeof(*v));
+    c->p += sizeof(*v);
+    return true;
+}
+
+/* Return the NUL-terminated string of @len bytes at the cursor */
+static char *get_str(trace_cursor_t *c, uint16_t len)
+{
+    if (c->end - c->p < (ptrdiff_t) len + 1 || c->p[len] != '\0')
+        return NULL;
+    char *s = c->p;
+    c->p += len + 1;
+    return s;
+}
+
+static bool is_compiled_trace(const char *fname)
+{
+    char magic[TRACE_MAGIC_LEN];
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool match = read(fd, magic, TRACE_MAGIC_LEN) == TRACE_MAGIC_LEN &&
+                 !memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    close(fd);
+    return match;
+}
+
+static bool replay_trace(char *fname)
+{
+    int fd = open(fname, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        report(1, "ERROR: Could not open source file '%s'", fname);
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    /* Private and writable, since commands may modify their arguments */
+    char *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                     fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        report(1, "ERROR: Could not map '%s'", fname);
+        return false;
+    }
+    has_infile = true;
+
+    trace_cursor_t c = {map + TRACE_MAGIC_LEN, map + st.st_size};
+    uint32_t n_names = 0, max_argc = 0;
+    bool valid = get_u32(&c, &n_names) && get_u32(&c, &max_argc) &&
+                 n_names <= MAX_OPCODES && max_argc <= UINT16_MAX;
+    char **names = NULL, **argv = NULL;
+    cmd_element_t **ops = NULL;
+    if (valid) {
+        names = calloc_or_fail(n_names + 1, sizeof(char *), "replay_trace");
+        ops = calloc_or_fail(n_names + 1, sizeof(cmd_element_t *),
+                             "replay_trace");
+        argv = calloc_or_fail(max_argc + 1, sizeof(char *), "replay_trace");
+    }
+    for (uint32_t i = 0; valid && i < n_names; i++) {
+        uint16_t len;
+        valid = get_u16(&c, &len) && (names[i] = get_str(&c, len));
+        if (valid)
+            ops[i] = find_cmd(names[i]);
+    }
+
+    while (valid && c.p < c.end && !quit_flag) {
+        uint16_t op, argc;
+        valid = get_u16(&c, &op) && get_u16(&c, &argc) && op < n_names &&
+                argc >= 1 && argc <= max_argc;
+        argv[0] = valid ? names[op] : NULL;
+        for (int i = 1; valid && i < argc; i++) {
+            uint16_t len;
+            valid = get_u16(&c, &len) && (argv[i] = get_str(&c, len));
+        }
+        if (!valid)
+            break;
+
+        /* Like commands read from a file, these are not echoed */
+        set_echo(0);
+        run_cmd(ops[op], argc, argv);
+        /* Commands read by 'source' */
+        while (!cmd_done())
+            cmd_select(0, NULL, NULL, NULL, NULL);
+    }
+    if (!valid) {
+        report(1, "ERROR: Compiled trace '%s' is corrupted", fname);
+        record_error();
+    }
+
+    if (names) {
+        free_array(names, n_names + 1, sizeof(char *));
+        free_array(ops, n_names + 1, sizeof(cmd_element_t *));
+        free_array(argv, max_argc + 1, sizeof(char *));
+    }
+    munmap(map, st.st_size);
+    return err_cnt == 0;
+}
+
 bool run_console(char *infile_name)
 {
+    if (infile_name && is_compiled_trace(infile_name))
+        return replay_trace(infile_name);
+
     if (!push_file(infile_name)) {
         report(1, "ERROR: Could not open source file '%s'", infile_name);
         return false;
@@ -688,9 +1517,10 @@ bool run_console(char *infile_name)
     if (!has_infile) {
         char *cmdline;
         while (use_linenoise && (cmdline = linenoise(prompt))) {
-            interpret_cmd(cmdline);
+            /* Before the line is split up */
             line_history_add(cmdline);       /* Add to the history. */
             line_history_save(HISTORY_FILE); /* Save the history on disk. */
+            interpret_cmd(cmdline);
             line_free(cmdline);
             while (buf_stack && buf_stack->fd != STDIN_FILENO)
                 cmd_select(0, NULL, NULL, NULL, NULL);
@@ -2,6 +2,7 @@
 #define LAB0_CONSOLE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/select.h>
 
 #include "linenoise.h"
@@ -35,6 +36,10 @@ typedef struct __param_element {
     char *name;
     int *valp;
     char *summary;
+    /* Optional NULL-terminated names of values 0, 1, ... */
+    const char *const *names;
+    /* Values accepted by option, 0 to the last name for named parameters */
+    int min, max;
     /* Function that gets called whenever parameter changes */
     setter_func_t setter;
     struct __param_element *next;
@@ -50,12 +55,37 @@ void add_cmd(char *name, cmd_func_t operation, char *summary, char *parameter);
 /* Add a new parameter */
 void add_param(char *name, int *valp, char *summary, setter_func_t setter);
 
+/* Add a new parameter that also accepts the value names in @names,
+ * which is terminated by NULL.  Name i stands for integer value i.
+ */
+void add_param_named(char *name,
+                     int *valp,
+                     const char *const *names,
+                     char *summary,
+                     setter_func_t setter);
+
+/* Add a new parameter that only takes values from @min to @max */
+void add_param_range(char *name,
+                     int *valp,
+                     int min,
+                     int max,
+                     char *summary,
+                     setter_func_t setter);
+
 /* Extract integer from text and store at loc */
 bool get_int(char *vname, int *loc);
 
+/* Extract 64-bit integer from text and store at loc */
+bool get_int64(char *vname, int64_t *loc);
+
 /* Add function to be executed as part of program exit */
 void add_quit_helper(cmd_func_t qf);
 
+/* Set function to be executed before every known command, with the same
+ * arguments.  Returning false marks the command as failed, but it still runs.
+ */
+void set_pre_cmd_helper(cmd_func_t hf);
+
 /* Turn echoing on/off */
 void set_echo(bool on);
 
@@ -64,7 +94,14 @@ void set_echo(bool on);
 /* Return true if no errors occurred */
 bool finish_cmd();
 
-/* Run command loop.  Non-null infile_name implies read commands from that file
+/* Translate the text trace @infile_name into the compiled trace
+ * @outfile_name, which run_console() replays without parsing.
+ * Return true if successful
+ */
+bool compile_trace(char *infile_name, char *outfile_name);
+
+/* Run command loop.  Non-null infile_name implies read commands from that file,
+ * either a text or a compiled trace
  */
 bool run_console(char *infile_name);
 
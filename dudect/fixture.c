@@ -34,6 +34,8 @@
 #include <string.h>
 
 #include "../console.h"
+#define INTERNAL 1
+#include "../harness.h"
 #include "../random.h"
 
 #include "constant.h"
@@ -164,6 +166,16 @@ static bool test_const(char *text, int mode)
     bool result = false;
     t = malloc(sizeof(t_context_t));
 
+    /* Measurements build and free a queue each, so reuse the freed blocks
+     * rather than go through the C library, whose timing depends on the
+     * state of its heap.  Sanitizer builds leave the cache off, to catch a
+     * use after free in the queue code.
+     */
+    int cache = alloc_cache_enabled;
+#if !defined(__SANITIZE_ADDRESS__)
+    alloc_cache_enabled = 1;
+#endif
+
     for (int cnt = 0; cnt < TEST_TRIES; ++cnt) {
         printf("Testing %s...(%d/%d)\n\n", text, cnt, TEST_TRIES);
         init_once();
@@ -174,6 +186,9 @@ static bool test_const(char *text, int mode)
         if (result)
             break;
     }
+    alloc_cache_enabled = cache;
+    if (!cache)
+        alloc_cache_flush();
     free(t);
     return result;
 }
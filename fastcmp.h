@@ -0,0 +1,47 @@
+#ifndef LAB0_FASTCMP_H
+#define LAB0_FASTCMP_H
+
+#include <stdbool.h>
+
+/* Vectorized string comparison.
+ *
+ * The kernels locate the first byte at which two strings differ or terminate,
+ * 16 (SSE2) or 32 (AVX2) bytes per step, and return a value with the same
+ * sign as strcmp(3).  The widest kernel supported by the running CPU is
+ * picked through CPUID on first use.
+ */
+
+typedef int (*strcmp_func_t)(const char *a, const char *b);
+
+/* Kernels known to this build, in increasing order of width */
+typedef enum {
+    FASTCMP_SCALAR,
+    FASTCMP_SSE2,
+    FASTCMP_AVX2,
+    N_FASTCMP,
+} fastcmp_kind_t;
+
+typedef struct {
+    const char *name;
+    strcmp_func_t func;
+    /* Return true when the running CPU is able to execute @func */
+    bool (*supported)(void);
+} fastcmp_kernel_t;
+
+extern const fastcmp_kernel_t fastcmp_kernels[N_FASTCMP];
+
+/* Currently selected kernel, resolved lazily */
+extern strcmp_func_t fastcmp_impl;
+
+static inline int fast_strcmp(const char *a, const char *b)
+{
+    return fastcmp_impl(a, b);
+}
+
+/* Select kernel @kind, or the best supported one if @kind is out of range.
+ * Falls back to narrower kernels the CPU cannot execute.
+ * Return: the kind actually installed
+ */
+fastcmp_kind_t fastcmp_select(int kind);
+
+#endif /* LAB0_FASTCMP_H */
@@ -0,0 +1,337 @@
+/* Generators of the strings inserted by ih and it, see gen.h */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gen.h"
+#include "random.h"
+
+#define MIN_RANDSTR_LEN 5
+#define MAX_RANDSTR_LEN 9
+
+/* Counters of seq and rev are printed with this many digits */
+#define SEQ_DIGITS 10
+#define SEQ_MAX 9999999999ULL
+
+/* dup repeats one of this many most recent values */
+#define DUP_RECENT 256
+
+/* Zipf words are WORD_LEN letters, so the vocabulary is at most 26^WORD_LEN;
+ * the table of probabilities limits it further.
+ */
+#define WORD_LEN 7
+#define WORD_SPACE 8031810176ULL /* 26^7 */
+#define ZIPF_MAX_WORDS (1 << 24)
+
+typedef enum {
+    GEN_RAND,
+    GEN_LEN,
+    GEN_SEQ,
+    GEN_REV,
+    GEN_DUP,
+    GEN_ZIPF,
+    GEN_FILE,
+} gen_kind_t;
+
+static const struct {
+    const char *prefix;
+    gen_kind_t kind;
+} gen_kinds[] = {
+    {"len:", GEN_LEN}, {"seq:", GEN_SEQ},   {"rev:", GEN_REV},
+    {"dup:", GEN_DUP}, {"zipf:", GEN_ZIPF}, {"file:", GEN_FILE},
+};
+
+#define N_GEN_KINDS (sizeof(gen_kinds) / sizeof(gen_kinds[0]))
+
+struct gen {
+    char *spec;
+    gen_kind_t kind;
+    int min_len, max_len; /* RAND, len */
+    const char *prefix;   /* seq, rev: points into spec */
+    uint64_t counter;     /* seq, rev */
+    double ratio;         /* dup */
+    char (*recent)[MAX_RANDSTR_LEN + 1];
+    int n_recent, next_recent;
+    double *cdf; /* zipf: cumulative probability of the first k + 1 words */
+    int n_words;
+    char **lines; /* file */
+    size_t n_lines;
+    struct gen *next;
+};
+
+static gen_t *gen_list = NULL;
+
+/* Random letters are generated in bulk and handed out in slices */
+#define RAND_POOL_SIZE 4096
+static char rand_pool[RAND_POOL_SIZE];
+static size_t rand_pool_pos = RAND_POOL_SIZE;
+
+static void rand_letters(char *buf, size_t len)
+{
+    if (len > RAND_POOL_SIZE / 4) {
+        prng_letters(buf, len);
+        return;
+    }
+    if (rand_pool_pos + len > RAND_POOL_SIZE) {
+        prng_letters(rand_pool, RAND_POOL_SIZE);
+        rand_pool_pos = 0;
+    }
+    memcpy(buf, rand_pool + rand_pool_pos, len);
+    rand_pool_pos += len;
+}
+
+/* Uniform in [0, 1) */
+static double rand_unit()
+{
+    return (prng_u64() >> 11) * 0x1.0p-53;
+}
+
+bool gen_is_spec(const char *text)
+{
+    if (!strcmp(text, "RAND"))
+        return true;
+    for (size_t i = 0; i < N_GEN_KINDS; i++) {
+        if (!strncmp(text, gen_kinds[i].prefix, strlen(gen_kinds[i].prefix)))
+            return true;
+    }
+    return false;
+}
+
+static const char *parse_len(gen_t *g, const char *arg)
+{
+    char tail;
+    if (sscanf(arg, "%d-%d%c", &g->min_len, &g->max_len, &tail) != 2)
+        return "expected len:min-max";
+    if (g->min_len < 1 || g->min_len > g->max_len ||
+        g->max_len >= GEN_MAX_LEN)
+        return "lengths must satisfy 1 <= min <= max < 256";
+    return NULL;
+}
+
+static const char *parse_dup(gen_t *g, const char *arg)
+{
+    char *end;
+    g->ratio = strtod(arg, &end);
+    if (end == arg || *end || !(g->ratio >= 0 && g->ratio <= 1))
+        return "ratio must be between 0 and 1";
+    g->recent = malloc(DUP_RECENT * sizeof(*g->recent));
+    return g->recent ? NULL : "out of memory";
+}
+
+static const char *parse_zipf(gen_t *g, const char *arg)
+{
+    char *end;
+    double s = strtod(arg, &end);
+    if (end == arg || *end != ',' || !(s >= 0))
+        return "expected zipf:s,N with s >= 0";
+    arg = end + 1;
+    errno = 0;
+    long n = strtol(arg, &end, 0);
+    if (end == arg || *end || errno || n < 1 || n > ZIPF_MAX_WORDS)
+        return "vocabulary size must be between 1 and 16777216";
+
+    g->n_words = n;
+    g->cdf = malloc(n * sizeof(double));
+    if (!g->cdf)
+        return "out of memory";
+    double sum = 0;
+    for (long k = 0; k < n; k++) {
+        sum += pow(k + 1, -s);
+        g->cdf[k] = sum;
+    }
+    for (long k = 0; k < n; k++)
+        g->cdf[k] /= sum;
+    return NULL;
+}
+
+static const char *parse_file(gen_t *g, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return strerror(errno);
+
+    char *line = NULL;
+    size_t cap = 0, alloc = 0;
+    ssize_t len;
+    const char *err = NULL;
+    while (!err && (len = getline(&line, &cap, f)) >= 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (!len)
+            continue;
+        if (len >= GEN_MAX_LEN)
+            line[GEN_MAX_LEN - 1] = '\0';
+        if (g->n_lines == alloc) {
+            alloc = alloc ? 2 * alloc : 64;
+            char **lines = realloc(g->lines, alloc * sizeof(char *));
+            if (!lines) {
+                err = "out of memory";
+                break;
+            }
+            g->lines = lines;
+        }
+        if (!(g->lines[g->n_lines] = strdup(line)))
+            err = "out of memory";
+        else
+            g->n_lines++;
+    }
+    free(line);
+    fclose(f);
+    if (!err && !g->n_lines)
+        err = "file holds no lines";
+    return err;
+}
+
+static void gen_free(gen_t *g)
+{
+    for (size_t i = 0; i < g->n_lines; i++)
+        free(g->lines[i]);
+    free(g->lines);
+    free(g->cdf);
+    free(g->recent);
+    free(g->spec);
+    free(g);
+}
+
+gen_t *gen_get(const char *spec, const char **err)
+{
+    for (gen_t *g = gen_list; g; g = g->next) {
+        if (!strcmp(g->spec, spec))
+            return g;
+    }
+
+    gen_t *g = calloc(1, sizeof(gen_t));
+    if (!g || !(g->spec = strdup(spec))) {
+        free(g);
+        *err = "out of memory";
+        return NULL;
+    }
+
+    const char *arg = g->spec;
+    g->kind = GEN_RAND;
+    for (size_t i = 0; i < N_GEN_KINDS; i++) {
+        size_t n = strlen(gen_kinds[i].prefix);
+        if (!strncmp(spec, gen_kinds[i].prefix, n)) {
+            g->kind = gen_kinds[i].kind;
+            arg += n;
+            break;
+        }
+    }
+
+    *err = NULL;
+    switch (g->kind) {
+    case GEN_RAND:
+        g->min_len = MIN_RANDSTR_LEN;
+        g->max_len = MAX_RANDSTR_LEN;
+        break;
+    case GEN_LEN:
+        *err = parse_len(g, arg);
+        break;
+    case GEN_SEQ:
+    case GEN_REV:
+        if (strlen(arg) >= GEN_MAX_LEN - SEQ_DIGITS)
+            *err = "prefix too long";
+        g->prefix = arg;
+        break;
+    case GEN_DUP:
+        *err = parse_dup(g, arg);
+        break;
+    case GEN_ZIPF:
+        *err = parse_zipf(g, arg);
+        break;
+    case GEN_FILE:
+        *err = parse_file(g, arg);
+        break;
+    }
+    if (*err) {
+        gen_free(g);
+        return NULL;
+    }
+
+    g->next = gen_list;
+    gen_list = g;
+    return g;
+}
+
+static void next_rand(int min_len, int max_len, char *buf, size_t size)
+{
+    size_t len = min_len + prng_u64() % (max_len - min_len + 1);
+    if (len >= size)
+        len = size - 1;
+    rand_letters(buf, len);
+    buf[len] = '\0';
+}
+
+/* Word of rank @k, distinct for all ranks of a vocabulary.  Multiplying by a
+ * constant prime to 26 permutes the ranks, so that the most frequent words
+ * are spread over the alphabet.
+ */
+static void zipf_word(uint64_t k, char *buf, size_t size)
+{
+    uint64_t x = (k + 1) * 2654435761ULL % WORD_SPACE;
+    size_t len = size > WORD_LEN ? WORD_LEN : size - 1;
+    for (size_t i = 0; i < len; i++, x /= 26)
+        buf[i] = 'a' + x % 26;
+    buf[len] = '\0';
+}
+
+void gen_next(gen_t *g, char *buf, size_t size)
+{
+    switch (g->kind) {
+    case GEN_RAND:
+    case GEN_LEN:
+        next_rand(g->min_len, g->max_len, buf, size);
+        break;
+    case GEN_SEQ:
+    case GEN_REV: {
+        uint64_t n = g->counter < SEQ_MAX ? g->counter++ : SEQ_MAX;
+        if (g->kind == GEN_REV)
+            n = SEQ_MAX - n;
+        snprintf(buf, size, "%s%0*" PRIu64, g->prefix, SEQ_DIGITS, n);
+        break;
+    }
+    case GEN_DUP:
+        if (g->n_recent && rand_unit() < g->ratio) {
+            snprintf(buf, size, "%s",
+                     g->recent[prng_u64() % g->n_recent]);
+            break;
+        }
+        next_rand(MIN_RANDSTR_LEN, MAX_RANDSTR_LEN, buf, size);
+        snprintf(g->recent[g->next_recent], sizeof(*g->recent), "%s", buf);
+        g->next_recent = (g->next_recent + 1) % DUP_RECENT;
+        if (g->n_recent < DUP_RECENT)
+            g->n_recent++;
+        break;
+    case GEN_ZIPF: {
+        double u = rand_unit();
+        int lo = 0, hi = g->n_words - 1;
+        /* First word whose cumulative probability exceeds u */
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (g->cdf[mid] > u)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        zipf_word(lo, buf, size);
+        break;
+    }
+    case GEN_FILE:
+        snprintf(buf, size, "%s", g->lines[prng_u64() % g->n_lines]);
+        break;
+    }
+}
+
+void gen_release_all()
+{
+    while (gen_list) {
+        gen_t *g = gen_list;
+        gen_list = g->next;
+        gen_free(g);
+    }
+}
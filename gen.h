@@ -0,0 +1,43 @@
+#ifndef LAB0_GEN_H
+#define LAB0_GEN_H
+
+/* Generators of the strings inserted by 'ih' and 'it'.
+ *
+ * A spec names the distribution of the values:
+ *   RAND           5 to 9 random lowercase letters
+ *   len:a-b        a to b random lowercase letters
+ *   seq:[prefix]   prefix and an increasing counter, in ascending order
+ *   rev:[prefix]   prefix and a decreasing counter, in descending order
+ *   dup:ratio      RAND, but repeating one of the recent values with
+ *                  probability ratio, between 0 and 1
+ *   zipf:s,N       words of a vocabulary of N, the k-th most frequent drawn
+ *                  with probability proportional to 1 / k^s
+ *   file:path      lines of a file, drawn uniformly
+ *
+ * Generators are kept per spec, so that the counters of seq and rev carry on
+ * from one command to the next and vocabularies are built only once.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Longest string a generator produces, including the terminator */
+#define GEN_MAX_LEN 256
+
+typedef struct gen gen_t;
+
+/* Return whether @text names a generator rather than a literal string */
+bool gen_is_spec(const char *text);
+
+/* Find or create the generator for @spec.
+ * Return: the generator, or NULL with a reason in *@err
+ */
+gen_t *gen_get(const char *spec, const char **err);
+
+/* Store the next string of @g in @buf of @size bytes */
+void gen_next(gen_t *g, char *buf, size_t size);
+
+/* Release every generator */
+void gen_release_all();
+
+#endif /* LAB0_GEN_H */
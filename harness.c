@@ -1,10 +1,16 @@
 /* Test support code */
 
+#include <execinfo.h>
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "report.h"
@@ -27,50 +33,326 @@
 /* Byte to fill newly malloced space with */
 #define FILLCHAR 0x55
 
+/* Bytes filled at POISON_PARTIAL */
+#define POISON_PARTIAL_BYTES 64
+
+/* Width of the payload size in a block header; the remaining bits of its word
+ * extend the slot index
+ */
+#define PAYLOAD_BITS 48
+
 /* Data structures used by our code */
 
-/* Represent allocated blocks as doubly-linked list, with
- * next and prev pointers at beginning
+/* Represent allocated blocks as a dense array of pointers per thread, with
+ * each block recording its owner and its position.  A pointer is a live
+ * block of the calling thread exactly when the position stored in front of
+ * it refers back to it, so checking a block, as well as adding and removing
+ * one, takes O(1).
  */
 typedef struct __block_element {
-    struct __block_element *next, *prev;
-    size_t payload_size;
-    size_t magic_header; /* Marker to see if block seems legitimate */
-    unsigned char payload[0];
+    uint32_t slot;         /* Index in allocated[] of the owner, low bits */
+    uint32_t magic_header; /* Marker to see if block seems legitimate */
+    /* The header stays at 32 bytes while still indexing more than 2^32
+     * blocks, as a queue of over 2^31 elements needs.
+     */
+    uint64_t payload_size : PAYLOAD_BITS;
+    uint64_t slot_high : 64 - PAYLOAD_BITS; /* High bits of slot */
+    struct __harness_thread *owner; /* Thread which allocated the block */
+    struct __alloc_site *site;      /* Profile entry, NULL if not profiled */
+    /* Keep the alignment malloc would give the payload */
+    unsigned char payload[0] __attribute__((aligned(16)));
     /* Also place magic number at tail of every block */
 } block_element_t;
 
-static block_element_t *allocated = NULL;
-static size_t allocated_count = 0;
+/* Allocation profile: statistics per call site of the allocation functions,
+ * kept in a fixed open-addressing table keyed by return address, and a
+ * histogram of request sizes in powers of 2.
+ */
+#define PROFILE_SITES 1024 /* Power of 2 */
+#define PROFILE_BINS 64
+
+typedef struct __alloc_site {
+    void *addr;
+    unsigned long count; /* Allocations */
+    unsigned long live;  /* Blocks not freed yet */
+    size_t bytes, live_bytes, peak_bytes;
+} alloc_site_t;
+
+int alloc_profile = PROFILE_OFF;
+static alloc_site_t profile_sites[PROFILE_SITES];
+static int profile_used = 0;
+static unsigned long profile_hist[PROFILE_BINS];
+
+/* Recently freed blocks, kept for reuse in one LIFO list per size class.
+ * Class k holds blocks with room for (k + 1) * CACHE_GRANULE payload bytes;
+ * larger requests always go to malloc.  A cached block keeps its MAGICFREE
+ * stamps and links to the next one through the start of its payload, followed
+ * by the complement of the link; all three are checked before it is reused.
+ * Off by default, since a freed block lives on in the cache, where a write
+ * after free goes unnoticed by the sanitizer and the C library.
+ */
+#define CACHE_GRANULE 16
+#define CACHE_CLASSES 16
+#define CACHE_DEPTH 16384 /* Per class at most; dudect frees 10000 at once */
+
+int alloc_cache_enabled = 0;
+
+/* Compact mode: blocks of cacheable size are carved out of one arena with no
+ * header or footer, so that an element and its string take 64 bytes instead
+ * of well over 100.  The arena is reserved up front as one span of addresses
+ * per size class, so the class of a block follows from its address, and
+ * memory is only committed as the spans fill up.  Freed blocks are linked
+ * through their payload for reuse.  Such blocks are neither checked nor
+ * profiled, and a double free goes unnoticed.
+ */
+#define COMPACT_SPAN ((size_t) 1 << 37) /* Addresses per class: 128 GB */
+
+int alloc_compact = 0;
+
+static unsigned char *compact_base = NULL; /* Set once, under compact_lock */
+static struct {
+    unsigned char *top; /* Start of the part never handed out */
+    void *free;         /* Freed blocks */
+} compact_class[CACHE_CLASSES];
+static size_t compact_live = 0;
+static pthread_mutex_t compact_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Bookkeeping of one thread.  Only the owner touches its block array and
+ * caches, so the fast path takes no lock.  A block freed by another thread
+ * is pushed on the lock-free remote_free stack of its owner, which takes it
+ * out of the array on its next call into the harness.  States are kept for
+ * the whole run, since blocks may outlive the thread that allocated them;
+ * once that thread has exited, whoever holds threads_lock drains its stack.
+ */
+typedef struct __harness_thread {
+    block_element_t **allocated;
+    size_t allocated_count; /* Also read by other threads */
+    size_t allocated_capacity;
+    block_element_t *cache_head[CACHE_CLASSES];
+    size_t cache_depth[CACHE_CLASSES];
+    alloc_cache_stats_t cache_stats;
+    block_element_t *remote_free; /* Linked like cached blocks */
+    size_t remote_pending;        /* Blocks on remote_free */
+    bool exited;
+    struct __harness_thread *next;
+} harness_thread_t;
+
+static harness_thread_t *threads = NULL; /* Guarded by threads_lock */
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static __thread harness_thread_t *this_thread = NULL;
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
+/* Fault injection schedules, all disabled at 0 */
+int fault_every = 0;
+int fault_burst = 0;
+int fault_after_bytes = 0;
+int fault_seed = 1;
+
+#define MAX_FAIL_AT 64
+
+/* Bumped by fault_reset(), so that every thread restarts its schedule */
+static int fault_epoch = 0;
+static unsigned long fail_at[MAX_FAIL_AT];
+static int n_fail_at = 0;
+
+static __thread int fault_epoch_seen = 0;
+static __thread uint64_t fault_state = 0x9e3779b97f4a7c15ULL + 1;
+static __thread unsigned long alloc_calls = 0;
+static __thread size_t alloc_bytes = 0;
+static __thread int burst_left = 0;
+static __thread int next_fail_at = 0;
+
+/* How much checking test_malloc and test_free do, one of poison_level_t */
+int poison_level = POISON_FULL;
+
+/* Check the footer of one in this many freed blocks */
+int footer_check_interval = 1;
+static __thread unsigned int frees_since_check = 0;
+
 static bool cautious_mode = true;
-static bool noallocate_mode = false;
-static bool error_occurred = false;
-static char *error_message = "";
+static __thread bool noallocate_mode = false;
+static __thread bool error_occurred = false;
+static __thread char *error_message = "";
 
-static int time_limit = 1;
+static __thread int time_limit_ms = 1000;
+int time_warn_percent = 0;
 
-/* Data for managing exceptions */
-static jmp_buf env;
-static volatile sig_atomic_t jmp_ready = false;
-static bool time_limited = false;
+/* Data for managing exceptions, per thread */
+static __thread jmp_buf env;
+static __thread volatile sig_atomic_t jmp_ready = false;
+static __thread bool time_limited = false;
+static __thread struct timespec time_start;
 
 /* Internal functions */
 
-/* Should this allocation fail? */
-static bool fail_allocation()
+/* xorshift64*, seeded by fault_reset() */
+static inline uint64_t fault_random()
+{
+    fault_state ^= fault_state >> 12;
+    fault_state ^= fault_state << 25;
+    fault_state ^= fault_state >> 27;
+    return fault_state * 0x2545f4914f6cdd1dULL;
+}
+
+/* Should this allocation of @size bytes fail? */
+static bool fail_allocation(size_t size)
+{
+    if (!(fail_probability | fault_every | fault_after_bytes | n_fail_at))
+        return false;
+
+    int epoch = __atomic_load_n(&fault_epoch, __ATOMIC_RELAXED);
+    if (fault_epoch_seen != epoch) {
+        fault_epoch_seen = epoch;
+        /* xorshift must not start from 0 */
+        fault_state = (uint64_t) fault_seed * 0x9e3779b97f4a7c15ULL + 1;
+        alloc_calls = 0;
+        alloc_bytes = 0;
+        burst_left = 0;
+        next_fail_at = 0;
+    }
+
+    alloc_calls++;
+    alloc_bytes += size;
+    if (burst_left > 0) {
+        burst_left--;
+        return true;
+    }
+
+    bool fail = false;
+    if (fault_every > 0 && alloc_calls % fault_every == 0)
+        fail = true;
+    if (fault_after_bytes > 0 && alloc_bytes > (size_t) fault_after_bytes)
+        fail = true;
+    while (next_fail_at < n_fail_at && fail_at[next_fail_at] < alloc_calls)
+        next_fail_at++;
+    if (next_fail_at < n_fail_at && fail_at[next_fail_at] == alloc_calls)
+        fail = true;
+    /* Upper 32 bits scaled to [0, 100) */
+    if (fail_probability > 0 &&
+        (int) (((fault_random() >> 32) * 100) >> 32) < fail_probability)
+        fail = true;
+
+    if (fail && fault_burst > 1)
+        burst_left = fault_burst - 1;
+    return fail;
+}
+
+static void thread_exit(void *arg)
+{
+    harness_thread_t *t = arg;
+    __atomic_store_n(&t->exited, true, __ATOMIC_RELEASE);
+}
+
+static void make_thread_key(void)
+{
+    pthread_key_create(&thread_key, thread_exit);
+}
+
+static harness_thread_t *register_thread(void)
+{
+    harness_thread_t *t = calloc(1, sizeof(harness_thread_t));
+    if (!t) {
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        exit(1);
+    }
+    pthread_once(&thread_key_once, make_thread_key);
+    pthread_setspecific(thread_key, t);
+
+    pthread_mutex_lock(&threads_lock);
+    t->next = threads;
+    threads = t;
+    pthread_mutex_unlock(&threads_lock);
+    return this_thread = t;
+}
+
+static inline harness_thread_t *get_thread(void)
+{
+    return this_thread ? this_thread : register_thread();
+}
+
+static inline size_t block_slot(const block_element_t *b)
+{
+    return (size_t) b->slot_high << 32 | b->slot;
+}
+
+static inline void set_block_slot(block_element_t *b, size_t slot)
+{
+    b->slot = (uint32_t) slot;
+    b->slot_high = slot >> 32;
+}
+
+/* Take block @b out of the array of @t */
+static inline void unlink_block(harness_thread_t *t, block_element_t *b)
+{
+    size_t count = t->allocated_count - 1;
+    block_element_t *last = t->allocated[count];
+    set_block_slot(last, block_slot(b));
+    t->allocated[block_slot(b)] = last;
+    __atomic_store_n(&t->allocated_count, count, __ATOMIC_RELAXED);
+}
+
+static bool cache_put(harness_thread_t *t, block_element_t *b);
+
+static inline block_element_t **cache_link(block_element_t *b)
 {
-    double weight = (double) random() / RAND_MAX;
-    return (weight < 0.01 * fail_probability);
+    return (block_element_t **) b->payload;
+}
+
+/* Complement of the link of a cached block, which has room for both */
+static inline uintptr_t *cache_check(block_element_t *b)
+{
+    return (uintptr_t *) b->payload + 1;
+}
+
+/* Hand block @b, freed by another thread, over to its owner */
+static void push_remote(block_element_t *b)
+{
+    harness_thread_t *owner = b->owner;
+    __atomic_fetch_add(&owner->remote_pending, 1, __ATOMIC_RELAXED);
+    block_element_t *head =
+        __atomic_load_n(&owner->remote_free, __ATOMIC_RELAXED);
+    do {
+        *cache_link(b) = head;
+    } while (!__atomic_compare_exchange_n(&owner->remote_free, &head, b, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Retire the blocks other threads freed on behalf of @t.  Called by @t
+ * itself, or by the holder of threads_lock once @t has exited, in which case
+ * the blocks are not cached.
+ */
+static void drain_remote(harness_thread_t *t, bool reuse)
+{
+    block_element_t *b =
+        __atomic_exchange_n(&t->remote_free, NULL, __ATOMIC_ACQUIRE);
+    while (b) {
+        block_element_t *next = *cache_link(b);
+        unlink_block(t, b);
+        __atomic_fetch_sub(&t->remote_pending, 1, __ATOMIC_RELAXED);
+        if (!reuse || !cache_put(t, b))
+            free(b);
+        b = next;
+    }
+}
+
+static bool known_thread(const harness_thread_t *owner)
+{
+    bool found = false;
+    pthread_mutex_lock(&threads_lock);
+    for (harness_thread_t *t = threads; t && !found; t = t->next)
+        found = t == owner;
+    pthread_mutex_unlock(&threads_lock);
+    return found;
 }
 
 /* Find header of block, given its payload.
  * Signal error if doesn't seem like legitimate block
  */
-static block_element_t *find_header(void *p)
+static block_element_t *find_header(harness_thread_t *self, void *p)
 {
     if (!p) {
         report_event(MSG_ERROR, "Attempting to free null block");
@@ -80,13 +362,15 @@ static block_element_t *find_header(void *p)
     block_element_t *b =
         (block_element_t *) ((size_t) p - sizeof(block_element_t));
     if (cautious_mode) {
-        /* Make sure this is really an allocated block */
-        block_element_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
-        }
+        /* Make sure this is really an allocated block.  The array of another
+         * thread may be moving under our feet, so a block owned by someone
+         * else is only checked to name a known thread, and by its magic
+         * below.
+         */
+        bool found = b->owner == self
+                         ? block_slot(b) < self->allocated_count &&
+                               self->allocated[block_slot(b)] == b
+                         : known_thread(b->owner);
         if (!found) {
             report_event(MSG_ERROR,
                          "Attempted to free unallocated block.  Address = %p",
@@ -115,22 +399,255 @@ static size_t *find_footer(block_element_t *b)
     return p;
 }
 
+/* Entry of call site @addr, NULL once the table is full.  Threads claim
+ * empty slots with compare-and-swap, so no lock is needed.
+ */
+static alloc_site_t *profile_site(void *addr)
+{
+    size_t mask = PROFILE_SITES - 1;
+    size_t i = (size_t) (((uintptr_t) addr * 0x9e3779b97f4a7c15ULL) >> 40);
+    for (i &= mask;; i = (i + 1) & mask) {
+        void *cur = __atomic_load_n(&profile_sites[i].addr, __ATOMIC_ACQUIRE);
+        if (cur == addr)
+            return &profile_sites[i];
+        if (cur)
+            continue;
+        /* Keep one slot free so that probing terminates */
+        if (__atomic_fetch_add(&profile_used, 1, __ATOMIC_RELAXED) >=
+            PROFILE_SITES - 1) {
+            __atomic_fetch_sub(&profile_used, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        if (__atomic_compare_exchange_n(&profile_sites[i].addr, &cur, addr,
+                                        false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE))
+            return &profile_sites[i];
+        /* Another thread took the slot first */
+        __atomic_fetch_sub(&profile_used, 1, __ATOMIC_RELAXED);
+        if (cur == addr)
+            return &profile_sites[i];
+    }
+}
+
+static void profile_alloc(block_element_t *b, void *addr)
+{
+    size_t size = b->payload_size;
+    int bin = size ? 64 - __builtin_clzl(size) : 0;
+    if (bin >= PROFILE_BINS)
+        bin = PROFILE_BINS - 1;
+    __atomic_fetch_add(&profile_hist[bin], 1, __ATOMIC_RELAXED);
+
+    alloc_site_t *site = b->site = profile_site(addr);
+    if (!site)
+        return;
+    __atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&site->live, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&site->bytes, size, __ATOMIC_RELAXED);
+    size_t live = __atomic_add_fetch(&site->live_bytes, size, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&site->peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&site->peak_bytes, &peak, live, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void profile_free(block_element_t *b)
+{
+    __atomic_fetch_sub(&b->site->live, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&b->site->live_bytes, b->payload_size, __ATOMIC_RELAXED);
+}
+
+static inline size_t cache_class(size_t size)
+{
+    return size ? (size - 1) / CACHE_GRANULE : 0;
+}
+
+/* Take a block with room for @size bytes from the cache of @t, NULL on a
+ * miss
+ */
+static block_element_t *cache_get(harness_thread_t *t, size_t size)
+{
+    if (!alloc_cache_enabled || size > CACHE_CLASSES * CACHE_GRANULE)
+        return NULL;
+    size_t k = cache_class(size);
+    block_element_t *b = t->cache_head[k];
+    if (!b) {
+        t->cache_stats.misses++;
+        return NULL;
+    }
+    block_element_t *next = *cache_link(b);
+    if (b->magic_header != MAGICFREE ||
+        b->payload_size != (k + 1) * CACHE_GRANULE ||
+        *find_footer(b) != MAGICFREE || *cache_check(b) != ~(uintptr_t) next) {
+        report_event(MSG_ERROR,
+                     "Corruption detected in freed block with address %p "
+                     "when reusing it",
+                     (void *) b->payload);
+        error_occurred = true;
+        /* The rest of the list can't be trusted, so leave it to leak */
+        t->cache_head[k] = NULL;
+        t->cache_depth[k] = 0;
+        return NULL;
+    }
+    t->cache_head[k] = next;
+    t->cache_depth[k]--;
+    t->cache_stats.hits++;
+    return b;
+}
+
+/* Keep freed block @b for reuse by @t.  Return false if it has to go to
+ * free
+ */
+static bool cache_put(harness_thread_t *t, block_element_t *b)
+{
+    size_t k = cache_class(b->payload_size);
+    if (!alloc_cache_enabled ||
+        b->payload_size > CACHE_CLASSES * CACHE_GRANULE ||
+        t->cache_depth[k] == CACHE_DEPTH)
+        return false;
+    /* Move the footer past the link and its check, to the end of the room */
+    b->payload_size = (k + 1) * CACHE_GRANULE;
+    *find_footer(b) = MAGICFREE;
+    *cache_link(b) = t->cache_head[k];
+    *cache_check(b) = ~(uintptr_t) t->cache_head[k];
+    t->cache_head[k] = b;
+    t->cache_depth[k]++;
+    return true;
+}
+
+static inline void poison(void *p, size_t size);
+
+static inline bool in_compact(const void *p)
+{
+    const unsigned char *base =
+        __atomic_load_n(&compact_base, __ATOMIC_ACQUIRE);
+    return base && (const unsigned char *) p >= base &&
+           (const unsigned char *) p < base + CACHE_CLASSES * COMPACT_SPAN;
+}
+
+static void *compact_alloc(size_t size)
+{
+    if (!__atomic_load_n(&compact_base, __ATOMIC_ACQUIRE) &&
+        !alloc_compact_reserve()) {
+        report_event(MSG_FATAL, "Couldn't reserve the compact arena");
+        error_occurred = true;
+        return NULL;
+    }
+    size_t k = cache_class(size);
+    size_t room = (k + 1) * CACHE_GRANULE;
+    unsigned char *end = compact_base + (k + 1) * COMPACT_SPAN;
+
+    pthread_mutex_lock(&compact_lock);
+    void *p = compact_class[k].free;
+    if (p) {
+        compact_class[k].free = *(void **) p;
+    } else if (compact_class[k].top + room <= end) {
+        p = compact_class[k].top;
+        compact_class[k].top += room;
+    }
+    if (p)
+        compact_live++;
+    pthread_mutex_unlock(&compact_lock);
+
+    if (!p) {
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        error_occurred = true;
+        return NULL;
+    }
+    poison(p, size);
+    return p;
+}
+
+static void compact_free(void *p)
+{
+    size_t offset = (unsigned char *) p - compact_base;
+    size_t k = offset / COMPACT_SPAN;
+    size_t room = (k + 1) * CACHE_GRANULE;
+    pthread_mutex_lock(&compact_lock);
+    if ((offset - k * COMPACT_SPAN) % room ||
+        (unsigned char *) p >= compact_class[k].top) {
+        pthread_mutex_unlock(&compact_lock);
+        report_event(MSG_ERROR,
+                     "Attempted to free unallocated block.  Address = %p", p);
+        error_occurred = true;
+        return;
+    }
+    poison(p, room);
+    *(void **) p = compact_class[k].free;
+    compact_class[k].free = p;
+    compact_live--;
+    pthread_mutex_unlock(&compact_lock);
+}
+
+/* Fill payload with FILLCHAR, as far as the poison level asks for */
+static inline void poison(void *p, size_t size)
+{
+    if (poison_level == POISON_FULL)
+        memset(p, FILLCHAR, size);
+    else if (poison_level == POISON_PARTIAL)
+        memset(p, FILLCHAR,
+               size < POISON_PARTIAL_BYTES ? size : POISON_PARTIAL_BYTES);
+}
+
+/* Whether the footer of the block being freed is due for a check */
+static inline bool footer_check_due(void)
+{
+    if (poison_level == POISON_OFF)
+        return false;
+    if (++frees_since_check < (unsigned int) footer_check_interval)
+        return false;
+    frees_since_check = 0;
+    return true;
+}
+
 /* Implementation of application functions */
 
-void *test_malloc(size_t size)
+/* Allocate a block on behalf of the caller at @addr */
+static void *alloc_block(size_t size, void *addr)
 {
     if (noallocate_mode) {
         report_event(MSG_FATAL, "Calls to malloc disallowed");
         return NULL;
     }
 
-    if (fail_allocation()) {
+    if (fail_allocation(size)) {
         report_event(MSG_WARN, "Malloc returning NULL");
         return NULL;
     }
+    if (size >> PAYLOAD_BITS) {
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        error_occurred = true;
+        return NULL;
+    }
+    if (alloc_compact && size <= CACHE_CLASSES * CACHE_GRANULE)
+        return compact_alloc(size);
 
-    block_element_t *new_block =
-        malloc(size + sizeof(block_element_t) + sizeof(size_t));
+    harness_thread_t *self = get_thread();
+    if (__atomic_load_n(&self->remote_free, __ATOMIC_RELAXED))
+        drain_remote(self, true);
+    if (self->allocated_count == self->allocated_capacity) {
+        size_t capacity =
+            self->allocated_capacity ? 2 * self->allocated_capacity : 1024;
+        block_element_t **blocks =
+            realloc(self->allocated, capacity * sizeof(block_element_t *));
+        if (!blocks) {
+            report_event(MSG_FATAL, "Couldn't allocate any more memory");
+            error_occurred = true;
+            return NULL;
+        }
+        self->allocated = blocks;
+        self->allocated_capacity = capacity;
+    }
+
+    /* Blocks of cacheable size get the whole room of their class, so that
+     * they can be reused for any request of that class.
+     */
+    size_t room = size;
+    if (size <= CACHE_CLASSES * CACHE_GRANULE)
+        room = (cache_class(size) + 1) * CACHE_GRANULE;
+    block_element_t *new_block = cache_get(self, size);
+    if (!new_block)
+        new_block = malloc(room + sizeof(block_element_t) + sizeof(size_t));
     if (!new_block) {
         report_event(MSG_FATAL, "Couldn't allocate any more memory");
         error_occurred = true;
@@ -140,22 +657,28 @@ void *test_malloc(size_t size)
     new_block->magic_header = MAGICHEADER;
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->payload_size = size;
+    /* Stamped at every level, so that raising it later stays consistent */
     *find_footer(new_block) = MAGICFOOTER;
     void *p = (void *) &new_block->payload;
-    memset(p, FILLCHAR, size);
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
+    poison(p, size);
     // cppcheck-suppress nullPointerRedundantCheck
-    new_block->prev = NULL;
-
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
-    allocated_count++;
+    new_block->owner = self;
+    set_block_slot(new_block, self->allocated_count);
+    self->allocated[self->allocated_count] = new_block;
+    __atomic_store_n(&self->allocated_count, self->allocated_count + 1,
+                     __ATOMIC_RELAXED);
+    new_block->site = NULL;
+    if (alloc_profile != PROFILE_OFF)
+        profile_alloc(new_block, addr);
 
     return p;
 }
 
+void *test_malloc(size_t size)
+{
+    return alloc_block(size, __builtin_return_address(0));
+}
+
 // cppcheck-suppress unusedFunction
 void *test_calloc(size_t nelem, size_t elsize)
 {
@@ -163,7 +686,7 @@ void *test_calloc(size_t nelem, size_t elsize)
      * https://danluu.com/malloc-tutorial/
      */
     size_t size = nelem * elsize;  // TODO: check for overflow
-    void *ptr = test_malloc(size);
+    void *ptr = alloc_block(size, __builtin_return_address(0));
     memset(ptr, 0, size);
     return ptr;
 }
@@ -178,9 +701,28 @@ void test_free(void *p)
     if (!p)
         return;
 
-    block_element_t *b = find_header(p);
-    size_t footer = *find_footer(b);
-    if (footer != MAGICFOOTER) {
+    /* Even once compact mode is off again */
+    if (in_compact(p)) {
+        compact_free(p);
+        return;
+    }
+
+    harness_thread_t *self = get_thread();
+    if (__atomic_load_n(&self->remote_free, __ATOMIC_RELAXED))
+        drain_remote(self, true);
+    block_element_t *b = find_header(self, p);
+    bool mine = b->owner == self;
+    bool live = mine ? block_slot(b) < self->allocated_count &&
+                           self->allocated[block_slot(b)] == b
+                     : b->magic_header == MAGICHEADER;
+    /* Freed already or never allocated, which find_header() has reported:
+     * leave it alone, where free() would abort in the C library.
+     */
+    if (!live) {
+        error_occurred = true;
+        return;
+    }
+    if (footer_check_due() && *find_footer(b) != MAGICFOOTER) {
         report_event(MSG_ERROR,
                      "Corruption detected in block with address %p when "
                      "attempting to free it",
@@ -189,27 +731,121 @@ void test_free(void *p)
     }
     b->magic_header = MAGICFREE;
     *find_footer(b) = MAGICFREE;
-    memset(p, FILLCHAR, b->payload_size);
+    poison(p, b->payload_size);
 
-    /* Unlink from list */
-    block_element_t *bn = b->next;
-    block_element_t *bp = b->prev;
-    if (bp)
-        bp->next = bn;
-    else
-        allocated = bn;
-    if (bn)
-        bn->prev = bp;
+    if (b->site)
+        profile_free(b);
+    if (!mine) {
+        push_remote(b);
+        return;
+    }
+    /* Fill the hole in the array with its last block */
+    unlink_block(self, b);
+    if (!cache_put(self, b))
+        free(b);
+}
+
+static void flush_cache(harness_thread_t *t)
+{
+    for (size_t k = 0; k < CACHE_CLASSES; k++) {
+        while (t->cache_head[k]) {
+            block_element_t *b = t->cache_head[k];
+            t->cache_head[k] = *cache_link(b);
+            free(b);
+        }
+        t->cache_depth[k] = 0;
+    }
+}
+
+/* Retire what exited threads left behind.  Caller holds threads_lock */
+static void adopt_exited(harness_thread_t *self)
+{
+    for (harness_thread_t *t = threads; t; t = t->next) {
+        if (t == self || !__atomic_load_n(&t->exited, __ATOMIC_ACQUIRE))
+            continue;
+        drain_remote(t, false);
+        flush_cache(t);
+    }
+}
+
+void alloc_cache_flush()
+{
+    harness_thread_t *self = get_thread();
+    drain_remote(self, false);
+    flush_cache(self);
+    pthread_mutex_lock(&threads_lock);
+    adopt_exited(self);
+    pthread_mutex_unlock(&threads_lock);
+}
+
+static int cmp_site_bytes(const void *a, const void *b)
+{
+    const alloc_site_t *x = *(alloc_site_t *const *) a;
+    const alloc_site_t *y = *(alloc_site_t *const *) b;
+    return (x->bytes < y->bytes) - (x->bytes > y->bytes);
+}
+
+void alloc_profile_report()
+{
+    if (!profile_used) {
+        report(1, "No allocation profile, see 'option profile'");
+        return;
+    }
+
+    alloc_site_t *sites[PROFILE_SITES];
+    void *addrs[PROFILE_SITES];
+    int n = 0;
+    for (int i = 0; i < PROFILE_SITES; i++) {
+        if (profile_sites[i].addr)
+            sites[n++] = &profile_sites[i];
+    }
+    qsort(sites, n, sizeof(*sites), cmp_site_bytes);
+    for (int i = 0; i < n; i++)
+        addrs[i] = sites[i]->addr;
+    /* Call sites as "file(function+offset)", offsets work with addr2line */
+    char **names = backtrace_symbols(addrs, n);
+
+    report(1, "%12s %14s %10s %14s  %s", "allocs", "bytes", "live",
+           "peak bytes", "call site");
+    for (int i = 0; i < n; i++) {
+        alloc_site_t *site = sites[i];
+        report(1, "%12lu %14lu %10lu %14lu  %s", site->count,
+               (unsigned long) site->bytes, site->live,
+               (unsigned long) site->peak_bytes, names ? names[i] : "?");
+    }
+    free(names);
 
-    free(b);
-    allocated_count--;
+    report(1, "Request sizes:");
+    for (int bin = 0; bin < PROFILE_BINS; bin++) {
+        if (!profile_hist[bin])
+            continue;
+        unsigned long lo = bin ? 1UL << (bin - 1) : 0;
+        report(1, "  %10lu .. %-10lu %12lu", lo, bin ? 2 * lo - 1 : 0,
+               profile_hist[bin]);
+    }
+}
+
+/* Sum of the counters of all threads, which go on running meanwhile */
+void alloc_cache_get_stats(alloc_cache_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&threads_lock);
+    for (harness_thread_t *t = threads; t; t = t->next) {
+        stats->hits += __atomic_load_n(&t->cache_stats.hits, __ATOMIC_RELAXED);
+        stats->misses +=
+            __atomic_load_n(&t->cache_stats.misses, __ATOMIC_RELAXED);
+        for (size_t k = 0; k < CACHE_CLASSES; k++)
+            stats->cached +=
+                __atomic_load_n(&t->cache_depth[k], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&threads_lock);
 }
 
 // cppcheck-suppress unusedFunction
 char *test_strdup(const char *s)
 {
     size_t len = strlen(s) + 1;
-    void *new = test_malloc(len);
+    void *new = alloc_block(len, __builtin_return_address(0));
     if (!new)
         return NULL;
 
@@ -218,13 +854,122 @@ char *test_strdup(const char *s)
 
 size_t allocation_check()
 {
-    return allocated_count;
+    harness_thread_t *self = get_thread();
+    drain_remote(self, true);
+
+    size_t count = 0;
+    pthread_mutex_lock(&threads_lock);
+    adopt_exited(self);
+    for (harness_thread_t *t = threads; t; t = t->next) {
+        size_t n = __atomic_load_n(&t->allocated_count, __ATOMIC_RELAXED);
+        size_t pending = __atomic_load_n(&t->remote_pending, __ATOMIC_RELAXED);
+        /* Freed elsewhere but not yet retired by a running owner */
+        count += n > pending ? n - pending : 0;
+    }
+    pthread_mutex_unlock(&threads_lock);
+
+    pthread_mutex_lock(&compact_lock);
+    count += compact_live;
+    pthread_mutex_unlock(&compact_lock);
+    return count;
+}
+
+bool alloc_compact_reserve()
+{
+    pthread_mutex_lock(&compact_lock);
+    if (!compact_base) {
+        unsigned char *base =
+            mmap(NULL, CACHE_CLASSES * COMPACT_SPAN, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base != MAP_FAILED) {
+            for (size_t k = 0; k < CACHE_CLASSES; k++)
+                compact_class[k].top = base + k * COMPACT_SPAN;
+            __atomic_store_n(&compact_base, base, __ATOMIC_RELEASE);
+        }
+    }
+    bool reserved = compact_base;
+    pthread_mutex_unlock(&compact_lock);
+    return reserved;
+}
+
+/* Check the bookkeeping of blocks at slots past 2^32 without allocating
+ * them: the array of allocated blocks is only reserved, and unlink_block()
+ * touches two of its pages.
+ */
+bool alloc_check_slots()
+{
+    static const size_t slots[] = {
+        0, UINT32_MAX, (size_t) 1 << 32, ((size_t) 1 << 32) + 1,
+        ((size_t) 1 << (32 + 64 - PAYLOAD_BITS)) - 1,
+    };
+    block_element_t b = {.magic_header = MAGICHEADER, .payload_size = 4321};
+    for (size_t i = 0; i < sizeof(slots) / sizeof(slots[0]); i++) {
+        set_block_slot(&b, slots[i]);
+        if (block_slot(&b) != slots[i] || b.payload_size != 4321 ||
+            b.magic_header != MAGICHEADER)
+            return false;
+    }
+
+    size_t count = ((size_t) 1 << 32) + 2;
+    size_t bytes = count * sizeof(block_element_t *);
+    block_element_t **allocated =
+        mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (allocated == MAP_FAILED)
+        return false;
+    harness_thread_t t = {
+        .allocated = allocated,
+        .allocated_count = count,
+        .allocated_capacity = count,
+    };
+    block_element_t hole = b, last = b;
+    set_block_slot(&hole, count - 2);
+    set_block_slot(&last, count - 1);
+    allocated[count - 2] = &hole;
+    allocated[count - 1] = &last;
+    /* The last block moves down into the hole */
+    unlink_block(&t, &hole);
+    bool ok = t.allocated_count == count - 1 &&
+              allocated[count - 2] == &last && block_slot(&last) == count - 2;
+    munmap(allocated, bytes);
+    return ok;
 }
 
 /* Implementation of functions for testing */
 
+static int cmp_call(const void *a, const void *b)
+{
+    unsigned long x = *(const unsigned long *) a;
+    unsigned long y = *(const unsigned long *) b;
+    return (x > y) - (x < y);
+}
+
+/* Restart the fault schedules: reseed from fault_seed and count calls and
+ * bytes from zero again.
+ */
+void fault_reset()
+{
+    /* Threads pick the change up on their next allocation */
+    __atomic_fetch_add(&fault_epoch, 1, __ATOMIC_RELAXED);
+}
+
+/* Make the allocations with the given call numbers fail, counted from the
+ * last fault_reset().  An empty list cancels.
+ */
+bool fault_set_fail_at(const unsigned long *calls, int n)
+{
+    if (n < 0 || n > MAX_FAIL_AT)
+        return false;
+    memcpy(fail_at, calls, n * sizeof(*calls));
+    qsort(fail_at, n, sizeof(*fail_at), cmp_call);
+    n_fail_at = n;
+    fault_reset();
+    return true;
+}
+
 /* Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
+ * The check takes constant time, so it can stay on for queues of any size.
  */
 void set_cautious_mode(bool cautious)
 {
@@ -239,6 +984,38 @@ void set_noallocate_mode(bool noallocate)
     noallocate_mode = noallocate;
 }
 
+void set_time_limit(int ms)
+{
+    time_limit_ms = ms > 0 ? ms : 0;
+}
+
+/* Arm the one-shot interval timer, or disarm it at 0 */
+static void arm_timer(int ms)
+{
+    struct itimerval it = {
+        .it_value = {.tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000},
+    };
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
+/* Disarm the timer and check the time used against the budget */
+static void stop_timer(bool expired)
+{
+    arm_timer(0);
+    time_limited = false;
+    if (expired || time_warn_percent <= 0)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double used_ms = (now.tv_sec - time_start.tv_sec) * 1e3 +
+                     (now.tv_nsec - time_start.tv_nsec) / 1e6;
+    double percent = used_ms * 100 / time_limit_ms;
+    if (percent >= time_warn_percent)
+        report_event(MSG_WARN, "Used %.0f%% of %d ms time limit (%.3f ms)",
+                     percent, time_limit_ms, used_ms);
+}
+
 /* Return whether any errors have occurred since last time set error limit */
 bool error_check()
 {
@@ -255,10 +1032,8 @@ bool exception_setup(bool limit_time)
     if (sigsetjmp(env, 1)) {
         /* Got here from longjmp */
         jmp_ready = false;
-        if (time_limited) {
-            alarm(0);
-            time_limited = false;
-        }
+        if (time_limited)
+            stop_timer(true);
 
         if (error_message)
             report_event(MSG_ERROR, error_message);
@@ -268,8 +1043,9 @@ bool exception_setup(bool limit_time)
 
     /* Got here from initial call */
     jmp_ready = true;
-    if (limit_time) {
-        alarm(time_limit);
+    if (limit_time && time_limit_ms > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &time_start);
+        arm_timer(time_limit_ms);
         time_limited = true;
     }
     return true;
@@ -278,10 +1054,8 @@ bool exception_setup(bool limit_time)
 /* Call once past risky code */
 void exception_cancel()
 {
-    if (time_limited) {
-        alarm(0);
-        time_limited = false;
-    }
+    if (time_limited)
+        stop_timer(false);
 
     jmp_ready = false;
     error_message = "";
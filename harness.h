@@ -24,6 +24,85 @@ size_t allocation_check();
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/* Deterministic fault injection, each schedule disabled at 0.  A failure
+ * from any schedule or the probability above starts a burst of fault_burst
+ * failing allocations.  Random draws come from a PRNG seeded with fault_seed,
+ * so a run with the same settings fails the same allocations.
+ */
+extern int fault_every;       /* Fail every Nth allocation */
+extern int fault_burst;       /* Length of a burst of failures */
+extern int fault_after_bytes; /* Fail once this many bytes are requested */
+extern int fault_seed;
+
+/* Restart the schedules: reseed and count allocations from zero again */
+void fault_reset();
+
+/* Fail the allocations numbered in @calls, counting from 1 after the reset
+ * this implies.  At most 64 numbers; an empty list cancels.
+ * Return: false if @n is out of range
+ */
+bool fault_set_fail_at(const unsigned long *calls, int n);
+
+/* How thoroughly test_malloc and test_free guard the blocks.  Every level
+ * keeps the header magic used to recognize blocks.
+ */
+typedef enum {
+    POISON_OFF,     /* No footer check, no fill */
+    POISON_CANARY,  /* Check the footer magic when freeing */
+    POISON_PARTIAL, /* Also fill the first 64 bytes on malloc and free */
+    POISON_FULL,    /* Also fill the whole payload */
+    N_POISON,
+} poison_level_t;
+
+/* Current level, one of poison_level_t */
+extern int poison_level;
+
+/* Check the footer of only one in this many freed blocks */
+extern int footer_check_interval;
+
+/* Whether freed blocks of small size are kept for reuse */
+extern int alloc_cache_enabled;
+
+typedef struct {
+    unsigned long hits;   /* Allocations served from the cache */
+    unsigned long misses; /* Cacheable allocations which found it empty */
+    size_t cached;        /* Blocks currently held */
+} alloc_cache_stats_t;
+
+void alloc_cache_get_stats(alloc_cache_stats_t *stats);
+
+/* Release every cached block to the system */
+void alloc_cache_flush();
+
+/* Whether blocks of cacheable size come from an arena without headers, for
+ * queues too large to afford them
+ */
+extern int alloc_compact;
+
+/* Reserve the address space of the arena, if not done yet.
+ * Return: false if it can't be
+ */
+bool alloc_compact_reserve();
+
+/* Check that blocks keep their place in the bookkeeping past 2^32 blocks */
+bool alloc_check_slots();
+
+/* Whether allocations are profiled per call site */
+typedef enum {
+    PROFILE_OFF,
+    PROFILE_ON,
+    PROFILE_EXIT, /* Also print the profile when quitting */
+    N_PROFILE,
+} profile_mode_t;
+
+/* Current mode, one of profile_mode_t */
+extern int alloc_profile;
+
+/* Print allocations, bytes, live blocks and peak live bytes per call site,
+ * and a histogram of request sizes
+ */
+void alloc_profile_report();
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
@@ -31,16 +110,30 @@ extern int fail_probability;
 void set_cautious_mode(bool cautious);
 
 /*
- * Set/unset restricted allocation mode.
+ * Set/unset restricted allocation mode for the calling thread.
  * In this mode, calls to malloc and free are disallowed.
  */
 void set_noallocate_mode(bool noallocate);
 
-/* Return whether any errors have occurred since last time checked */
+/* Budget of the time-limited exception_setup() calls of the calling thread,
+ * in milliseconds, unlimited at 0
+ */
+void set_time_limit(int ms);
+
+/* Warn when a time-limited operation uses at least this percentage of its
+ * budget, disabled at 0
+ */
+extern int time_warn_percent;
+
+/* Return whether any errors have occurred in the calling thread since last
+ * time checked
+ */
 bool error_check();
 
 /* Prepare for a risky operation using setjmp.
- * Function returns true for initial return, false for error return
+ * Function returns true for initial return, false for error return.
+ * The jump buffer is per thread; only the main thread may pass @limit_time,
+ * since the alarm signal is delivered to it alone.
  */
 bool exception_setup(bool limit_time);
 
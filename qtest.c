@@ -3,6 +3,9 @@
 #include <assert.h>
 #include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdio.h>
@@ -19,9 +22,13 @@
 #include <time.h>
 #endif
 
+#include "dudect/cpucycles.h"
 #include "dudect/fixture.h"
+#include "fastcmp.h"
+#include "gen.h"
 #include "list.h"
 #include "random.h"
+#include "sort.h"
 
 /* Shannon entropy */
 extern double shannon_entropy(const uint8_t *input_data);
@@ -53,7 +60,6 @@ extern int show_entropy;
 
 /* How large is a queue before it's considered big.
  * This affects how it gets printed
- * and whether cautious mode is used when freeing the queue
  */
 #define BIG_LIST_SIZE 30
 
@@ -73,12 +79,84 @@ static int fail_count = 0;
 
 static int string_length = MAXSTRING;
 
-#define MIN_RANDSTR_LEN 5
-#define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
 
+/* String comparison kernel used by queue operations */
+static int simd_kind = N_FASTCMP - 1;
+static const char *const simd_names[N_FASTCMP + 1] = {
+    [FASTCMP_SCALAR] = "scalar",
+    [FASTCMP_SSE2] = "sse2",
+    [FASTCMP_AVX2] = "avx2",
+    [N_FASTCMP] = NULL,
+};
+
+/* Order established by the sort command */
+static int sort_order = SORT_ASCEND;
+
+/* Whether queues keep a value index, see q_index() */
+static int use_index = 0;
+
+static const char *const profile_names[N_PROFILE + 1] = {
+    [PROFILE_OFF] = "off",
+    [PROFILE_ON] = "on",
+    [PROFILE_EXIT] = "exit",
+    [N_PROFILE] = NULL,
+};
+
+/* How thoroughly queues are checked after each command */
+typedef enum {
+    VERIFY_OFF,
+    VERIFY_SAMPLED, /* Windows at both ends and at random, see check_queue */
+    VERIFY_FULL,
+    VERIFY_ASYNC, /* Full, on a thread running alongside the next command */
+    N_VERIFY,
+} verify_mode_t;
+
+static int verify_mode = VERIFY_FULL;
+
+static const char *const verify_names[N_VERIFY + 1] = {
+    [VERIFY_OFF] = "off",
+    [VERIFY_SAMPLED] = "sampled",
+    [VERIFY_FULL] = "full",
+    [VERIFY_ASYNC] = "async",
+    [N_VERIFY] = NULL,
+};
+
+/* Time limits in milliseconds, by the kind of work a command does */
+typedef enum {
+    LIMIT_DEFAULT,
+    LIMIT_INSERT, /* ih, it */
+    LIMIT_REMOVE, /* rh, rt, dm, rmval */
+    LIMIT_SORT,   /* sort, sortk, merge */
+    N_LIMIT,
+} limit_class_t;
+
+static int time_limits[N_LIMIT] = {
+    [LIMIT_DEFAULT] = 1000,
+    [LIMIT_INSERT] = 1000,
+    [LIMIT_REMOVE] = 1000,
+    [LIMIT_SORT] = 1000,
+};
+
+/* exception_setup() with the time limit of @cls.  A macro rather than a
+ * function, since exception_setup() must be called from the frame which the
+ * longjmp returns to.
+ */
+#define exception_setup_limit(cls) \
+    (set_time_limit(time_limits[cls]), exception_setup(true))
+
+static const char *const poison_names[N_POISON + 1] = {
+    [POISON_OFF] = "off",
+    [POISON_CANARY] = "canary",
+    [POISON_PARTIAL] = "partial64",
+    [POISON_FULL] = "full",
+    [N_POISON] = NULL,
+};
+
 /* Forward declarations */
-static bool q_show(int vlevel);
+static bool q_show(int vlevel, bool check);
+static bool q_verify(int order, bool unique);
+static bool verify_wait(queue_contex_t *ctx);
 
 static bool do_free(int argc, char *argv[])
 {
@@ -95,9 +173,6 @@ static bool do_free(int argc, char *argv[])
     }
     error_check();
 
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
-
     struct list_head *qnext = NULL;
     if (chain.size > 1) {
         qnext = ((uintptr_t) &current->chain.next == (uintptr_t) &chain.head)
@@ -108,10 +183,9 @@ static bool do_free(int argc, char *argv[])
     if (current) {
         list_del(&current->chain);
 
-        if (exception_setup(true))
+        if (exception_setup_limit(LIMIT_DEFAULT))
             q_free(current->q);
         exception_cancel();
-        set_cautious_mode(true);
     }
 
     if (current) {
@@ -120,7 +194,7 @@ static bool do_free(int argc, char *argv[])
         current = qnext ? list_entry(qnext, queue_contex_t, chain) : NULL;
     }
 
-    q_show(3);
+    q_verify(-1, false);
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
@@ -141,37 +215,24 @@ static bool do_new(int argc, char *argv[])
 
     bool ok = true;
 
-    if (exception_setup(true)) {
+    if (exception_setup_limit(LIMIT_DEFAULT)) {
         queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
         list_add_tail(&qctx->chain, &chain.head);
 
         qctx->size = 0;
         qctx->q = q_new();
         qctx->id = chain.size++;
+        if (use_index && !q_index(qctx->q, true))
+            report(1, "Could not build value index");
 
         current = qctx;
     }
     exception_cancel();
-    q_show(3);
+    q_verify(-1, false);
 
     return ok && !error_check();
 }
 
-/* TODO: Add a buf_size check of if the buf_size may be less
- * than MIN_RANDSTR_LEN.
- */
-static void fill_rand_string(char *buf, size_t buf_size)
-{
-    size_t len = 0;
-    while (len < MIN_RANDSTR_LEN)
-        len = rand() % buf_size;
-
-    randombytes((uint8_t *) buf, len);
-    for (size_t n = 0; n < len; n++)
-        buf[n] = charset[buf[n] % (sizeof(charset) - 1)];
-    buf[len] = '\0';
-}
-
 /* insert head */
 static bool do_ih(int argc, char *argv[])
 {
@@ -191,9 +252,10 @@ static bool do_ih(int argc, char *argv[])
     }
 
     char *lasts = NULL;
-    char randstr_buf[MAX_RANDSTR_LEN];
-    int reps = 1;
-    bool ok = true, need_rand = false;
+    char genbuf[GEN_MAX_LEN];
+    gen_t *gen = NULL;
+    int64_t reps = 1;
+    bool ok = true;
     if (argc != 2 && argc != 3) {
         report(1, "%s needs 1-2 arguments", argv[0]);
         return false;
@@ -201,25 +263,30 @@ static bool do_ih(int argc, char *argv[])
 
     char *inserts = argv[1];
     if (argc == 3) {
-        if (!get_int(argv[2], &reps)) {
+        if (!get_int64(argv[2], &reps)) {
             report(1, "Invalid number of insertions '%s'", argv[2]);
             return false;
         }
     }
 
-    if (!strcmp(inserts, "RAND")) {
-        need_rand = true;
-        inserts = randstr_buf;
+    if (gen_is_spec(inserts)) {
+        const char *err;
+        gen = gen_get(inserts, &err);
+        if (!gen) {
+            report(1, "Invalid generator '%s': %s", inserts, err);
+            return false;
+        }
+        inserts = genbuf;
     }
 
     if (!current || !current->q)
         report(3, "Warning: Calling insert head on null queue");
     error_check();
 
-    if (current && exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
-            if (need_rand)
-                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+    if (current && exception_setup_limit(LIMIT_INSERT)) {
+        for (int64_t r = 0; ok && r < reps; r++) {
+            if (gen)
+                gen_next(gen, genbuf, sizeof(genbuf));
             bool rval = q_insert_head(current->q, inserts);
             if (rval) {
                 current->size++;
@@ -258,7 +325,7 @@ static bool do_ih(int argc, char *argv[])
     }
     exception_cancel();
 
-    q_show(3);
+    q_verify(-1, false);
     return ok;
 }
 
@@ -280,9 +347,10 @@ static bool do_it(int argc, char *argv[])
         return ok;
     }
 
-    char randstr_buf[MAX_RANDSTR_LEN];
-    int reps = 1;
-    bool ok = true, need_rand = false;
+    char genbuf[GEN_MAX_LEN];
+    gen_t *gen = NULL;
+    int64_t reps = 1;
+    bool ok = true;
     if (argc != 2 && argc != 3) {
         report(1, "%s needs 1-2 arguments", argv[0]);
         return false;
@@ -290,25 +358,30 @@ static bool do_it(int argc, char *argv[])
 
     char *inserts = argv[1];
     if (argc == 3) {
-        if (!get_int(argv[2], &reps)) {
+        if (!get_int64(argv[2], &reps)) {
             report(1, "Invalid number of insertions '%s'", argv[2]);
             return false;
         }
     }
 
-    if (!strcmp(inserts, "RAND")) {
-        need_rand = true;
-        inserts = randstr_buf;
+    if (gen_is_spec(inserts)) {
+        const char *err;
+        gen = gen_get(inserts, &err);
+        if (!gen) {
+            report(1, "Invalid generator '%s': %s", inserts, err);
+            return false;
+        }
+        inserts = genbuf;
     }
 
     if (!current || !current->q)
         report(3, "Warning: Calling insert tail on null queue");
     error_check();
 
-    if (current && exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
-            if (need_rand)
-                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+    if (current && exception_setup_limit(LIMIT_INSERT)) {
+        for (int64_t r = 0; ok && r < reps; r++) {
+            if (gen)
+                gen_next(gen, genbuf, sizeof(genbuf));
             bool rval = q_insert_tail(current->q, inserts);
             if (rval) {
                 current->size++;
@@ -333,7 +406,7 @@ static bool do_it(int argc, char *argv[])
         }
     }
     exception_cancel();
-    q_show(3);
+    q_verify(-1, false);
     return ok;
 }
 
@@ -398,7 +471,7 @@ static bool do_remove(int option, int argc, char *argv[])
     error_check();
 
     element_t *re = NULL;
-    if (current && exception_setup(true))
+    if (current && exception_setup_limit(LIMIT_REMOVE))
         re = option ? q_remove_tail(current->q, removes, string_length + 1)
                     : q_remove_head(current->q, removes, string_length + 1);
     exception_cancel();
@@ -448,7 +521,7 @@ static bool do_remove(int option, int argc, char *argv[])
         ok = false;
     }
 
-    q_show(3);
+    q_verify(-1, false);
 
     free(removes);
     free(checks);
@@ -465,6 +538,45 @@ static inline bool do_rt(int argc, char *argv[])
     return do_remove(1, argc, argv);
 }
 
+/* Release a list built by copy_queue() */
+static void free_copy(struct list_head *l)
+{
+    element_t *item, *tmp;
+    list_for_each_entry_safe (item, tmp, l, list) {
+        free(item->value);
+        free(item);
+    }
+    INIT_LIST_HEAD(l);
+}
+
+/* Append copies of the elements in @src to @dst with the regular allocator,
+ * so the copy is invisible to the harness.
+ * Return: false if out of memory, in which case @dst is left empty
+ */
+static bool copy_queue(struct list_head *dst, struct list_head *src)
+{
+    element_t *item;
+    list_for_each_entry (item, src, list) {
+        element_t *tmp = malloc(sizeof(element_t));
+        if (!tmp)
+            break;
+        size_t slen = strlen(item->value) + 1;
+        tmp->value = malloc(slen);
+        if (!tmp->value) {
+            free(tmp);
+            break;
+        }
+        memcpy(tmp->value, item->value, slen);
+        list_add_tail(&tmp->list, dst);
+    }
+    // Return false if the loop does not leave properly
+    if (&item->list != src) {
+        free_copy(dst);
+        return false;
+    }
+    return true;
+}
+
 static bool do_dedup(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -473,48 +585,23 @@ static bool do_dedup(int argc, char *argv[])
     }
 
     LIST_HEAD(l_copy);
-    element_t *item = NULL, *tmp = NULL;
+    element_t *item = NULL;
 
     // Copy current->q to l_copy
-    if (current->q && !list_empty(current->q)) {
-        list_for_each_entry (item, current->q, list) {
-            size_t slen;
-            tmp = malloc(sizeof(element_t));
-            if (!tmp)
-                break;
-            INIT_LIST_HEAD(&tmp->list);
-            slen = strlen(item->value) + 1;
-            tmp->value = malloc(slen);
-            if (!tmp->value) {
-                free(tmp);
-                break;
-            }
-            memcpy(tmp->value, item->value, slen);
-            list_add_tail(&tmp->list, &l_copy);
-        }
-        // Return false if the loop does not leave properly
-        if (&item->list != current->q) {
-            list_for_each_entry_safe (item, tmp, &l_copy, list) {
-                free(item->value);
-                free(item);
-            }
-            report(1,
-                   "INTERNAL ERROR.  Could not allocate space for "
-                   "duplicate checking");
-            return false;
-        }
+    if (current->q && !copy_queue(&l_copy, current->q)) {
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for "
+               "duplicate checking");
+        return false;
     }
 
     bool ok = true;
-    if (exception_setup(true))
+    if (exception_setup_limit(LIMIT_DEFAULT))
         ok = q_delete_dup(current->q);
     exception_cancel();
 
     if (!ok) {
-        list_for_each_entry_safe (item, tmp, &l_copy, list) {
-            free(item->value);
-            free(item);
-        }
+        free_copy(&l_copy);
         report(1, "ERROR: Calling delete duplicate on null queue");
         return false;
     }
@@ -546,12 +633,9 @@ static bool do_dedup(int argc, char *argv[])
                "ERROR: Duplicate strings are in queue or distinct strings are "
                "not in queue");
 
-    list_for_each_entry_safe (item, tmp, &l_copy, list) {
-        free(item->value);
-        free(item);
-    }
+    free_copy(&l_copy);
 
-    q_show(3);
+    q_verify(-1, false);
     return ok && !error_check();
 }
 
@@ -567,12 +651,12 @@ static bool do_reverse(int argc, char *argv[])
     error_check();
 
     set_noallocate_mode(true);
-    if (current && exception_setup(true))
+    if (current && exception_setup_limit(LIMIT_DEFAULT))
         q_reverse(current->q);
     exception_cancel();
 
     set_noallocate_mode(false);
-    q_show(3);
+    q_verify(-1, false);
     return !error_check();
 }
 
@@ -583,7 +667,7 @@ static bool do_size(int argc, char *argv[])
         return false;
     }
 
-    int reps = 1;
+    int64_t reps = 1;
     bool ok = true;
     if (argc != 1 && argc != 2) {
         report(1, "%s needs 0-1 arguments", argv[0]);
@@ -591,17 +675,17 @@ static bool do_size(int argc, char *argv[])
     }
 
     if (argc == 2) {
-        if (!get_int(argv[1], &reps))
-            report(1, "Invalid number of calls to size '%s'", argv[2]);
+        if (!get_int64(argv[1], &reps))
+            report(1, "Invalid number of calls to size '%s'", argv[1]);
     }
 
-    int cnt = 0;
+    size_t cnt = 0;
     if (!current || !current->q)
         report(3, "Warning: Calling size on null queue");
     error_check();
 
-    if (current && exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
+    if (current && exception_setup_limit(LIMIT_DEFAULT)) {
+        for (int64_t r = 0; ok && r < reps; r++) {
             cnt = q_size(current->q);
             ok = ok && !error_check();
         }
@@ -610,16 +694,17 @@ static bool do_size(int argc, char *argv[])
 
     if (current && ok) {
         if (current->size == cnt) {
-            report(2, "Queue size = %d", cnt);
+            report(2, "Queue size = %zu", cnt);
         } else {
             report(1,
-                   "ERROR: Computed queue size as %d, but correct value is %d",
-                   cnt, (int) current->size);
+                   "ERROR: Computed queue size as %zu, but correct value is "
+                   "%zu",
+                   cnt, current->size);
             ok = false;
         }
     }
 
-    q_show(3);
+    q_verify(-1, false);
 
     return ok && !error_check();
 }
@@ -631,7 +716,7 @@ bool do_sort(int argc, char *argv[])
         return false;
     }
 
-    int cnt = 0;
+    size_t cnt = 0;
     if (!current || !current->q)
         report(3, "Warning: Calling sort on null queue");
     else
@@ -643,29 +728,465 @@ bool do_sort(int argc, char *argv[])
     error_check();
 
     set_noallocate_mode(true);
-    if (current && exception_setup(true))
-        q_sort(current->q);
+    if (current && exception_setup_limit(LIMIT_SORT)) {
+        if (sort_order == SORT_ASCEND) {
+            q_sort(current->q);
+        } else {
+            sort_by_order(current->q, sort_order);
+            q_set_sorted(current->q, false);
+        }
+    }
     exception_cancel();
     set_noallocate_mode(false);
 
+    /* Also when q_sort() found the queue known to be sorted, to catch a flag
+     * set wrongly
+     */
+    bool ok = q_verify(sort_order, false);
+    return ok && !error_check();
+}
+
+/* Cycles taken by @sort to sort a fresh copy of @src in @order */
+static int64_t time_sort_copy(void (*sort)(struct list_head *, sort_order_t),
+                              struct list_head *src,
+                              sort_order_t order,
+                              bool *ok)
+{
+    LIST_HEAD(l_copy);
+    if (!copy_queue(&l_copy, src)) {
+        *ok = false;
+        return 0;
+    }
+
+    int64_t before = cpucycles();
+    sort(&l_copy, order);
+    int64_t after = cpucycles();
+
+    element_t *item;
+    list_for_each_entry (item, &l_copy, list) {
+        if (item->list.next == &l_copy)
+            break;
+        if (sort_order_cmp(order, item->value,
+                           list_entry(item->list.next, element_t, list)
+                               ->value) > 0) {
+            report(1, "ERROR: Not sorted in %s order",
+                   sort_order_names[order]);
+            *ok = false;
+            break;
+        }
+    }
+    free_copy(&l_copy);
+    return after - before;
+}
+
+static bool do_orderbench(int argc, char *argv[])
+{
+    int reps = 5;
+    if (argc > 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+    if (argc == 2 && (!get_int(argv[1], &reps) || reps <= 0)) {
+        report(1, "Invalid number of repetitions '%s'", argv[1]);
+        return false;
+    }
+    if (!current || !current->q) {
+        report(3, "Warning: Calling orderbench on null queue");
+        return false;
+    }
+
     bool ok = true;
-    if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
-            /* Ensure each element in ascending order */
-            /* FIXME: add an option to specify sorting order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) > 0) {
-                report(1, "ERROR: Not sorted in ascending order");
+    report(1, "%-10s%16s%16s%10s", "order", "inline", "indirect", "speedup");
+    for (int order = 0; ok && order < N_SORT_ORDER; order++) {
+        /* Keep the fastest run of each path to filter out noise */
+        int64_t best_inline = INT64_MAX, best_indirect = INT64_MAX;
+        for (int r = 0; ok && r < reps; r++) {
+            int64_t t = time_sort_copy(sort_by_order, current->q, order, &ok);
+            if (t < best_inline)
+                best_inline = t;
+            t = time_sort_copy(sort_by_order_indirect, current->q, order,
+                               &ok);
+            if (t < best_indirect)
+                best_indirect = t;
+        }
+        if (ok)
+            report(1, "%-10s%16" PRId64 "%16" PRId64 "%9.2fx",
+                   sort_order_names[order], best_inline, best_indirect,
+                   (double) best_indirect / (best_inline ? best_inline : 1));
+    }
+    if (!ok)
+        report(1, "INTERNAL ERROR.  Sort benchmark failed");
+    return ok;
+}
+
+/* Check that @l is ascending and holds the same strings as @ref, if given */
+static bool check_sorted_copy(struct list_head *l, struct list_head *ref)
+{
+    struct list_head *r = ref ? ref->next : NULL;
+    element_t *item;
+    list_for_each_entry (item, l, list) {
+        if (item->list.next != l &&
+            strcmp(item->value,
+                   list_entry(item->list.next, element_t, list)->value) > 0)
+            return false;
+        if (ref) {
+            if (r == ref ||
+                strcmp(item->value, list_entry(r, element_t, list)->value))
+                return false;
+            r = r->next;
+        }
+    }
+    return !ref || r == ref;
+}
+
+static bool do_sortbench(int argc, char *argv[])
+{
+    int reps = 3;
+    if (argc > 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+    if (argc == 2 && (!get_int(argv[1], &reps) || reps <= 0)) {
+        report(1, "Invalid number of repetitions '%s'", argv[1]);
+        return false;
+    }
+    if (!current || !current->q) {
+        report(3, "Warning: Calling sortbench on null queue");
+        return false;
+    }
+
+    /* Output of the first engine serves as reference for the later ones */
+    LIST_HEAD(ref);
+    bool ok = true;
+    report(1, "%-10s%16s%14s  %s", "engine", "cycles", "compares", "result");
+    for (int e = 0; ok && e < N_SORT_ENGINE; e++) {
+        int64_t best = INT64_MAX;
+        uint64_t compares = 0;
+        bool correct = true;
+        for (int r = 0; ok && r < reps; r++) {
+            LIST_HEAD(l_copy);
+            if (!copy_queue(&l_copy, current->q)) {
                 ok = false;
                 break;
             }
+            sort_cmp_count = 0;
+            int64_t before = cpucycles();
+            sort_engines[e].counted(&l_copy);
+            int64_t after = cpucycles();
+            if (after - before < best)
+                best = after - before;
+            compares = sort_cmp_count;
+
+            struct list_head *expect = list_empty(&ref) ? NULL : &ref;
+            correct = correct && check_sorted_copy(&l_copy, expect);
+            if (list_empty(&ref))
+                list_splice_init(&l_copy, &ref);
+            else
+                free_copy(&l_copy);
+        }
+        if (!ok)
+            break;
+        report(1, "%-10s%16" PRId64 "%14" PRIu64 "  %s", sort_engines[e].name,
+               best, compares, correct ? "ok" : "WRONG");
+        ok = correct;
+    }
+    free_copy(&ref);
+
+    if (!ok)
+        report(1, "ERROR: Sort engines disagree or failed to sort");
+    return ok;
+}
+
+static bool do_sortk(int argc, char *argv[])
+{
+    int64_t k = 0;
+    if (argc != 2 || !get_int64(argv[1], &k) || k < 0) {
+        report(1, "%s needs one non-negative integer K", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q)
+        report(3, "Warning: Calling sortk on null queue");
+    error_check();
+
+    bool ok = false;
+    if (current && exception_setup_limit(LIMIT_SORT))
+        ok = q_sort_k(current->q, k);
+    exception_cancel();
+
+    if (!ok) {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Partial sort failed");
+            ok = true;
+        } else {
+            report(1, "ERROR: Partial sort failed (%d failures total)",
+                   fail_count);
         }
+        q_verify(-1, false);
+        return ok && !error_check();
     }
 
-    q_show(3);
+    /* The first K elements ascend and none of the others precede them */
+    int64_t cnt = 0;
+    element_t *kth = NULL, *item;
+    list_for_each_entry (item, current->q, list) {
+        if (cnt < k && kth && strcmp(kth->value, item->value) > 0) {
+            report(1,
+                   "ERROR: First %" PRId64
+                   " elements are not in ascending order",
+                   k);
+            ok = false;
+            break;
+        }
+        if (cnt >= k && kth && strcmp(kth->value, item->value) > 0) {
+            report(1,
+                   "ERROR: %s is among the %" PRId64
+                   " smallest but was left behind",
+                   item->value, k);
+            ok = false;
+            break;
+        }
+        if (++cnt <= k)
+            kth = item;
+    }
+
+    q_verify(-1, false);
+    return ok && !error_check();
+}
+
+static bool do_select(int argc, char *argv[])
+{
+    int64_t k = 0;
+    if ((argc != 2 && argc != 3) || !get_int64(argv[1], &k)) {
+        report(1, "%s needs rank K and optionally the expected value",
+               argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q)
+        report(3, "Warning: Calling select on null queue");
+    error_check();
+
+    element_t *e = NULL;
+    if (current && k > 0 && exception_setup_limit(LIMIT_DEFAULT))
+        e = q_select(current->q, k);
+    exception_cancel();
+
+    if (!e && current && k > 0 && (size_t) k <= q_size(current->q)) {
+        /* K is in range, so only its heap allocation can have failed */
+        fail_count++;
+        bool ok = fail_count < fail_limit;
+        if (ok)
+            report(2, "Select failed");
+        else
+            report(1, "ERROR: Select failed (%d failures total)", fail_count);
+        q_verify(-1, false);
+        return ok && !error_check();
+    }
+    if (!e) {
+        report(1, "ERROR: No element of rank %" PRId64, k);
+        return false;
+    }
+
+    /* Fewer than K elements are smaller and at least K are not larger */
+    bool ok = true;
+    int64_t smaller = 0, not_larger = 0;
+    element_t *item;
+    list_for_each_entry (item, current->q, list) {
+        int res = strcmp(item->value, e->value);
+        smaller += res < 0;
+        not_larger += res <= 0;
+    }
+    if (smaller >= k || not_larger < k) {
+        report(1, "ERROR: %s is not the element of rank %" PRId64, e->value,
+               k);
+        ok = false;
+    } else if (argc == 3 && strcmp(e->value, argv[2])) {
+        report(1, "ERROR: Selected value %s != expected value %s", e->value,
+               argv[2]);
+        ok = false;
+    } else {
+        report(2, "Selected %s", e->value);
+    }
+
+    q_verify(-1, false);
+    return ok && !error_check();
+}
+
+static void fault_changed(int oldval)
+{
+    fault_reset();
+}
+
+static bool do_failat(int argc, char *argv[])
+{
+    unsigned long calls[64] = {0};
+    if (argc - 1 > 64) {
+        report(1, "%s takes at most 64 allocation numbers", argv[0]);
+        return false;
+    }
+    for (int i = 1; i < argc; i++) {
+        int n;
+        if (!get_int(argv[i], &n) || n <= 0) {
+            report(1, "Invalid allocation number '%s'", argv[i]);
+            return false;
+        }
+        calls[i - 1] = n;
+    }
+    fault_set_fail_at(calls, argc - 1);
+    if (argc > 1)
+        report(2, "Failing %d allocations, counted from now", argc - 1);
+    return true;
+}
+
+static void cache_changed(int oldval)
+{
+    if (!alloc_cache_enabled)
+        alloc_cache_flush();
+}
+
+static void compact_changed(int oldval)
+{
+    if (alloc_compact && !alloc_compact_reserve()) {
+        report(1, "Couldn't reserve the address space of the compact arena");
+        alloc_compact = oldval;
+    }
+}
+
+static bool do_slotcheck(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!alloc_check_slots()) {
+        report(1, "ERROR: Blocks past 2^32 lose their place in the harness");
+        return false;
+    }
+    return true;
+}
+
+static bool do_allocstats(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    alloc_cache_stats_t stats;
+    alloc_cache_get_stats(&stats);
+    unsigned long lookups = stats.hits + stats.misses;
+    report(1, "Live blocks: %lu", (unsigned long) allocation_check());
+    report(1, "Cache: %lu hits, %lu misses (%.1f%% hit rate), %lu blocks held",
+           stats.hits, stats.misses,
+           lookups ? 100.0 * stats.hits / lookups : 0.0,
+           (unsigned long) stats.cached);
+    alloc_profile_report();
+    return true;
+}
+
+static void index_changed(int oldval)
+{
+    queue_contex_t *ctx;
+    list_for_each_entry (ctx, &chain.head, chain) {
+        if (!q_index(ctx->q, use_index)) {
+            report(1, "Could not build value index of queue %d", ctx->id);
+            break;
+        }
+    }
+}
+
+static bool do_find(int argc, char *argv[])
+{
+    int64_t expect = 0;
+    if ((argc != 2 && argc != 3) ||
+        (argc == 3 && !get_int64(argv[2], &expect))) {
+        report(1, "%s needs a string and optionally the expected count",
+               argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q)
+        report(3, "Warning: Calling find on null queue");
+    error_check();
+
+    size_t count = 0;
+    bool found = false;
+    if (current && exception_setup_limit(LIMIT_DEFAULT)) {
+        found = q_contains(current->q, argv[1]);
+        count = q_count(current->q, argv[1]);
+    }
+    exception_cancel();
+
+    bool ok = true;
+    if (found != (count > 0)) {
+        report(1, "ERROR: q_contains and q_count disagree about %s", argv[1]);
+        ok = false;
+    } else if (argc == 3) {
+        /* Only walk the queue when asked to, to keep timings meaningful */
+        size_t actual = 0;
+        element_t *item;
+        list_for_each_entry (item, current->q, list)
+            actual += !strcmp(item->value, argv[1]);
+        if (count != actual || (int64_t) count != expect) {
+            report(1,
+                   "ERROR: Found %zu copies of %s, %zu in queue, expected "
+                   "%" PRId64,
+                   count, argv[1], actual, expect);
+            ok = false;
+        }
+    }
+    if (ok)
+        report(2, "Found %zu copies of %s", count, argv[1]);
+
+    return ok && !error_check();
+}
+
+static bool do_rmval(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs a string", argv[0]);
+        return false;
+    }
+
+    char *removes = malloc(string_length + 1);
+    if (!removes) {
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for removed strings");
+        return false;
+    }
+    removes[0] = '\0';
+
+    if (!current || !current->size)
+        report(3, "Warning: Calling rmval on empty queue");
+    error_check();
+
+    element_t *re = NULL;
+    if (current && exception_setup_limit(LIMIT_REMOVE))
+        re = q_remove_value(current->q, argv[1], removes, string_length + 1);
+    exception_cancel();
+
+    bool ok = true;
+    if (!re) {
+        report(1, "ERROR: No element holds %s", argv[1]);
+        ok = false;
+    } else {
+        if (strcmp(re->value, argv[1]) ||
+            strncmp(removes, argv[1], string_length)) {
+            report(1, "ERROR: Removed value %s != expected value %s",
+                   re->value, argv[1]);
+            ok = false;
+        } else {
+            report(2, "Removed %s from queue", removes);
+        }
+        q_release_element(re);
+        current->size--;
+    }
+    free(removes);
+
+    q_verify(-1, false);
     return ok && !error_check();
 }
 
@@ -681,12 +1202,12 @@ static bool do_dm(int argc, char *argv[])
     error_check();
 
     bool ok = true;
-    if (exception_setup(true))
+    if (exception_setup_limit(LIMIT_REMOVE))
         ok = q_delete_mid(current->q);
     exception_cancel();
 
     current->size--;
-    q_show(3);
+    q_verify(-1, false);
     return ok && !error_check();
 }
 
@@ -702,13 +1223,13 @@ static bool do_swap(int argc, char *argv[])
     error_check();
 
     set_noallocate_mode(true);
-    if (exception_setup(true))
+    if (exception_setup_limit(LIMIT_DEFAULT))
         q_swap(current->q);
     exception_cancel();
 
     set_noallocate_mode(false);
 
-    q_show(3);
+    q_verify(-1, false);
     return !error_check();
 }
 
@@ -724,12 +1245,12 @@ static bool do_descend(int argc, char *argv[])
     error_check();
 
 
-    int cnt = q_size(current->q);
+    size_t cnt = q_size(current->q);
     if (cnt < 2)
         report(3, "Warning: Calling ascend on single node");
     error_check();
 
-    if (exception_setup(true))
+    if (exception_setup_limit(LIMIT_DEFAULT))
         current->size = q_descend(current->q);
     set_noallocate_mode(false);
 
@@ -752,20 +1273,20 @@ static bool do_descend(int argc, char *argv[])
         }
     }
 
-    q_show(3);
+    q_verify(-1, false);
     return ok && !error_check();
 }
 
 static bool do_reverseK(int argc, char *argv[])
 {
-    int k = 0;
+    int64_t k = 0;
 
     if (!current || !current->q)
         report(3, "Warning: Calling reverseK on null queue");
     error_check();
 
     if (argc == 2) {
-        if (!get_int(argv[1], &k)) {
+        if (!get_int64(argv[1], &k)) {
             report(1, "Invalid number of K");
             return false;
         }
@@ -775,19 +1296,20 @@ static bool do_reverseK(int argc, char *argv[])
     }
 
     set_noallocate_mode(true);
-    if (exception_setup(true))
-        q_reverseK(current->q, k);
+    if (exception_setup_limit(LIMIT_DEFAULT))
+        q_reverseK(current->q, k > 0 ? k : 0);
     exception_cancel();
 
     set_noallocate_mode(false);
-    q_show(3);
+    q_verify(-1, false);
     return !error_check();
 }
 
 static bool do_merge(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    bool unique = argc == 2 && !strcmp(argv[1], "unique");
+    if (argc != 1 && !unique) {
+        report(1, "%s takes no arguments or 'unique'", argv[0]);
         return false;
     }
 
@@ -797,10 +1319,11 @@ static bool do_merge(int argc, char *argv[])
     }
     error_check();
 
-    int len = 0;
-    set_noallocate_mode(true);
-    if (current && exception_setup(true))
-        len = q_merge(&chain.head);
+    size_t len = 0;
+    /* q_merge_unique() may allocate its heap */
+    set_noallocate_mode(!unique);
+    if (current && exception_setup_limit(LIMIT_SORT))
+        len = unique ? q_merge_unique(&chain.head) : q_merge(&chain.head);
     exception_cancel();
     set_noallocate_mode(false);
 
@@ -820,49 +1343,427 @@ static bool do_merge(int argc, char *argv[])
         chain.head.prev = &current->chain;
         current->chain.next = &chain.head;
     }
+    /* Grow the index to the merged size, which q_merge() may not allocate */
+    if (q_is_indexed(current->q))
+        q_index(current->q, true);
+
+    bool ok = q_verify(SORT_ASCEND, unique);
+    return ok && !error_check();
+}
+
+static void verify_changed(int oldval)
+{
+    if (verify_mode != VERIFY_ASYNC)
+        verify_wait(NULL);
+}
+
+static void simd_changed(int oldval)
+{
+    simd_kind = fastcmp_select(simd_kind);
+    if (simd_kind != oldval)
+        report(1, "String comparison uses %s kernel",
+               fastcmp_kernels[simd_kind].name);
+}
+
+/* Cycles per call of @cmp over @reps comparisons of @a and @b */
+static double bench_strcmp(strcmp_func_t cmp,
+                           const char *a,
+                           const char *b,
+                           int reps)
+{
+    volatile int sink = 0;
+    int64_t before = cpucycles();
+    for (int r = 0; r < reps; r++)
+        sink += cmp(a, b);
+    int64_t after = cpucycles();
+    (void) sink;
+    return (double) (after - before) / reps;
+}
+
+#define MAX_STRESS_THREADS 64
+
+/* Start a thread with SIGALRM blocked from its first instruction: time
+ * limits are for the main thread to enforce, and a thread inherits the mask
+ * of its creator, so block it around pthread_create() only.
+ */
+static int create_unalarmed(pthread_t *thread, void *(*fn)(void *), void *arg)
+{
+    sigset_t set, old;
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+    int err = pthread_create(thread, NULL, fn, arg);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return err;
+}
+
+/* One thread of mtstress, mixing inserts and removes on its own queue */
+typedef struct {
+    pthread_t tid;
+    int ops;
+    unsigned int seed;
+    struct list_head *q; /* Left for the main thread to free */
+    bool error;
+} stress_worker_t;
+
+static void *stress_worker(void *arg)
+{
+    stress_worker_t *w = arg;
+    char buf[16];
+    if (exception_setup(false)) {
+        w->q = q_new();
+        for (int i = 0; w->q && i < w->ops; i++) {
+            unsigned int r = rand_r(&w->seed);
+            element_t *e = NULL;
+            snprintf(buf, sizeof(buf), "s%u", r % 1000);
+            switch ((r >> 16) % 3) {
+            case 0:
+                q_insert_head(w->q, buf);
+                break;
+            case 1:
+                q_insert_tail(w->q, buf);
+                break;
+            default:
+                e = q_remove_head(w->q, NULL, 0);
+                break;
+            }
+            if (e)
+                q_release_element(e);
+        }
+    }
+    exception_cancel();
+    w->error = error_check();
+    return NULL;
+}
+
+static bool do_mtstress(int argc, char *argv[])
+{
+    int n_threads = 4, ops = 100000;
+    if (argc > 3 || (argc > 1 && !get_int(argv[1], &n_threads)) ||
+        (argc > 2 && !get_int(argv[2], &ops)) || n_threads <= 0 ||
+        n_threads > MAX_STRESS_THREADS || ops < 0) {
+        report(1, "%s takes number of threads (1 to %d) and operations",
+               argv[0], MAX_STRESS_THREADS);
+        return false;
+    }
+    error_check();
+
+    size_t before = allocation_check();
+    stress_worker_t workers[MAX_STRESS_THREADS];
+    double t;
+    init_time(&t);
+    int started = 0;
+    for (; started < n_threads; started++) {
+        stress_worker_t *w = &workers[started];
+        w->ops = ops;
+        w->seed = started + 1;
+        w->q = NULL;
+        w->error = false;
+        if (create_unalarmed(&w->tid, stress_worker, w))
+            break;
+    }
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i].tid, NULL);
+    double elapsed = delta_time(&t);
+
+    /* Blocks of the workers are now freed by another thread */
+    bool ok = started == n_threads;
+    if (!ok)
+        report(1, "ERROR: Could only start %d threads", started);
+    for (int i = 0; i < started; i++) {
+        if (workers[i].error) {
+            report(1, "ERROR: Thread %d detected an error", i);
+            ok = false;
+        }
+        q_free(workers[i].q);
+    }
+
+    size_t after = allocation_check();
+    if (after != before) {
+        report(1, "ERROR: %lu blocks allocated before and %lu after",
+               (unsigned long) before, (unsigned long) after);
+        ok = false;
+    }
+    if (elapsed > 0)
+        report(1, "%d threads x %d operations: %.2f Mops/s", started, ops,
+               started * (double) ops / elapsed / 1e6);
+    return ok && !error_check();
+}
+
+static bool do_cmpbench(int argc, char *argv[])
+{
+    int reps = 100000;
+    if (argc > 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+    if (argc == 2 && (!get_int(argv[1], &reps) || reps <= 0)) {
+        report(1, "Invalid number of repetitions '%s'", argv[1]);
+        return false;
+    }
+
+    /* Strings share every byte but the last, so each call scans them fully.
+     * The second one is misaligned on purpose.
+     */
+    char *a = malloc(MAXSTRING + 1);
+    char *b = malloc(MAXSTRING + 2);
+    if (!a || !b) {
+        free(a);
+        free(b);
+        report(1, "INTERNAL ERROR.  Could not allocate benchmark strings");
+        return false;
+    }
+
+    report_noreturn(1, "%-8s%10s", "length", "libc");
+    for (int k = 0; k < N_FASTCMP; k++) {
+        if (fastcmp_kernels[k].supported())
+            report_noreturn(1, "%10s", fastcmp_kernels[k].name);
+    }
+    report(1, "  (cycles/call)");
 
     bool ok = true;
-    if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --len; cur_l = cur_l->next) {
-            /* Ensure each element in ascending order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) > 0) {
-                report(1,
-                       "ERROR: Not sorted in ascending order (It might because "
-                       "of unsorted queues are merged or there're some flaws "
-                       "in 'q_merge')");
+    for (int len = 8; len <= MAXSTRING; len *= 2) {
+        for (int i = 0; i < len; i++)
+            a[i] = b[i + 1] = charset[i % (sizeof(charset) - 1)];
+        a[len] = b[len + 1] = '\0';
+        b[len] = 'Z';
+
+        report_noreturn(1, "%-8d%10.1f", len,
+                        bench_strcmp(strcmp, a, b + 1, reps));
+        for (int k = 0; k < N_FASTCMP; k++) {
+            const fastcmp_kernel_t *kern = &fastcmp_kernels[k];
+            if (!kern->supported())
+                continue;
+            /* Sign must agree with libc before timing means anything */
+            if ((kern->func(a, b + 1) > 0) != (strcmp(a, b + 1) > 0) ||
+                kern->func(a, a) != 0) {
+                report(1, "ERROR: %s kernel disagrees with strcmp", kern->name);
                 ok = false;
                 break;
             }
+            report_noreturn(1, "%10.1f",
+                            bench_strcmp(kern->func, a, b + 1, reps));
         }
+        report(1, "");
     }
 
-    q_show(3);
-    return ok && !error_check();
+    free(a);
+    free(b);
+    return ok;
 }
 
-static bool is_circular()
+/* What the checks after a command verify besides the links */
+typedef struct {
+    int order;      /* sort_order_t the values must be in, or -1 */
+    bool unique;    /* Also forbid equal neighbours */
+    element_t *bad; /* Set to the first element of an offending pair */
+} check_t;
+
+typedef enum {
+    CHECK_OK,
+    CHECK_LINKS,  /* NULL link, or next and prev disagree */
+    CHECK_LENGTH, /* Number of elements differs from the recorded size */
+    CHECK_ORDER,
+    CHECK_DUP,
+} check_result_t;
+
+/* Walk up to @n steps forward from *@pos, stopping early at @head.  Check the
+ * back link of every node reached and the order of every pair of elements.
+ * On success *@pos is the node reached and *@steps the steps taken.
+ */
+static check_result_t check_forward(struct list_head *head,
+                                    struct list_head **pos,
+                                    size_t n,
+                                    check_t *c,
+                                    size_t *steps)
 {
-    struct list_head *cur = current->q->next;
-    while (cur != current->q) {
-        if (!cur)
-            return false;
-        cur = cur->next;
+    struct list_head *cur = *pos;
+    size_t i = 0;
+    while (i < n) {
+        struct list_head *next = cur->next;
+        if (!next || next->prev != cur)
+            return CHECK_LINKS;
+        if (c->order >= 0 && cur != head && next != head) {
+            element_t *a = list_entry(cur, element_t, list);
+            element_t *b = list_entry(next, element_t, list);
+            int cmp = sort_order_cmp(c->order, a->value, b->value);
+            if (cmp > 0 || (c->unique && !cmp)) {
+                c->bad = a;
+                return cmp > 0 ? CHECK_ORDER : CHECK_DUP;
+            }
+        }
+        cur = next;
+        i++;
+        if (cur == head)
+            break;
+    }
+    *pos = cur;
+    *steps = i;
+    return CHECK_OK;
+}
+
+/* Walk @n steps backward from @cur checking forward links.
+ * Return: node reached, or NULL on a broken link
+ */
+static struct list_head *walk_back(struct list_head *cur, size_t n)
+{
+    while (n-- > 0) {
+        struct list_head *prev = cur->prev;
+        if (!prev || prev->next != cur)
+            return NULL;
+        cur = prev;
     }
+    return cur;
+}
 
-    cur = current->q->prev;
-    while (cur != current->q) {
-        if (!cur)
-            return false;
-        cur = cur->prev;
+/* Sampled verification looks at windows of this many nodes: one at each end
+ * and VERIFY_SAMPLES starting at random within VERIFY_REACH nodes of either
+ * end.  Smaller queues are checked in full.
+ */
+#define VERIFY_WINDOW 32
+#define VERIFY_SAMPLES 4
+#define VERIFY_REACH 4096
+#define VERIFY_SAMPLED_MIN (4 * VERIFY_WINDOW)
+
+static check_result_t check_queue(queue_contex_t *ctx, bool sampled, check_t *c)
+{
+    struct list_head *head = ctx->q, *pos = head;
+    size_t size = ctx->size, steps;
+    check_result_t r;
+
+    if (!sampled || size <= VERIFY_SAMPLED_MIN) {
+        r = check_forward(head, &pos, size + 1, c, &steps);
+        if (r == CHECK_OK && (pos != head || steps != size + 1))
+            r = CHECK_LENGTH;
+        return r;
+    }
+
+    /* Head window */
+    r = check_forward(head, &pos, VERIFY_WINDOW, c, &steps);
+    if (r != CHECK_OK)
+        return r;
+    if (pos == head)
+        return CHECK_LENGTH;
+
+    /* Tail window, which must end at the head */
+    pos = walk_back(head, VERIFY_WINDOW);
+    if (!pos)
+        return CHECK_LINKS;
+    r = check_forward(head, &pos, VERIFY_WINDOW, c, &steps);
+    if (r == CHECK_OK && (pos != head || steps != VERIFY_WINDOW))
+        r = CHECK_LENGTH;
+
+    size_t reach = size - VERIFY_WINDOW - 1;
+    if (reach > VERIFY_REACH)
+        reach = VERIFY_REACH;
+    for (int i = 0; r == CHECK_OK && i < VERIFY_SAMPLES; i++) {
+        uint64_t rnd = prng_u64();
+        size_t off = (rnd >> 1) % reach;
+        if (rnd & 1) {
+            pos = head;
+            r = check_forward(head, &pos, off + 1, c, &steps);
+        } else {
+            pos = walk_back(head, off + VERIFY_WINDOW + 1);
+            if (!pos)
+                r = CHECK_LINKS;
+        }
+        if (r == CHECK_OK)
+            r = check_forward(head, &pos, VERIFY_WINDOW, c, &steps);
+        if (r == CHECK_OK && pos == head)
+            r = CHECK_LENGTH;
     }
-    return true;
+    return r;
 }
 
-static bool q_show(int vlevel)
+static bool report_check(check_result_t r, queue_contex_t *ctx, check_t *c)
+{
+    switch (r) {
+    case CHECK_OK:
+        return true;
+    case CHECK_LINKS:
+        report(1, "ERROR:  Queue is not doubly circular");
+        break;
+    case CHECK_LENGTH:
+        report(1, "ERROR:  Queue does not hold %zu elements", ctx->size);
+        break;
+    case CHECK_ORDER:
+        report(1, "ERROR: Not sorted in %s order at '%s'",
+               sort_order_names[c->order], c->bad->value);
+        break;
+    case CHECK_DUP:
+        report(1, "ERROR: Duplicate string '%s' left in queue",
+               c->bad->value);
+        break;
+    }
+    return false;
+}
+
+/* Full verification of one queue running on a background thread, for
+ * 'option verify async'
+ */
+static struct {
+    pthread_t thread;
+    bool pending;
+    queue_contex_t *ctx;
+    int id;
+    check_t check;
+    check_result_t result;
+} bg_verify;
+
+static void *verify_worker(void *arg)
+{
+    bg_verify.result = check_queue(bg_verify.ctx, false, &bg_verify.check);
+    return NULL;
+}
+
+/* Wait for the background verification of @ctx, or of any queue if @ctx is
+ * NULL, and report its result
+ */
+static bool verify_wait(queue_contex_t *ctx)
+{
+    if (!bg_verify.pending || (ctx && ctx != bg_verify.ctx))
+        return true;
+
+    pthread_join(bg_verify.thread, NULL);
+    bg_verify.pending = false;
+    if (bg_verify.result == CHECK_OK)
+        return true;
+    report(1, "ERROR: Background verification of queue %d failed",
+           bg_verify.id);
+    return report_check(bg_verify.result, bg_verify.ctx, &bg_verify.check);
+}
+
+static bool verify_start(queue_contex_t *ctx, check_t *c)
+{
+    bool ok = verify_wait(NULL);
+    bg_verify.ctx = ctx;
+    bg_verify.id = ctx->id;
+    bg_verify.check = *c;
+    if (create_unalarmed(&bg_verify.thread, verify_worker, NULL)) {
+        /* Verify in place instead */
+        check_result_t r = check_queue(ctx, false, c);
+        return report_check(r, ctx, c) && ok;
+    }
+    bg_verify.pending = true;
+    return ok;
+}
+
+/* Before each command, wait for the verification of any queue it may
+ * modify: none for commands which switch queues, every queue for merge and
+ * quit, and the current one for the rest.
+ */
+static bool verify_helper(int argc, char *argv[])
+{
+    if (!strcmp(argv[0], "new") || !strcmp(argv[0], "prev") ||
+        !strcmp(argv[0], "next"))
+        return true;
+    /* Threads do not survive the fork of a checkpoint */
+    bool all = !strcmp(argv[0], "merge") || !strcmp(argv[0], "quit") ||
+               !strcmp(argv[0], "checkpoint");
+    return verify_wait(all ? NULL : current);
+}
+
+static bool q_show(int vlevel, bool check)
 {
     bool ok = true;
     if (verblevel < vlevel)
@@ -874,9 +1775,11 @@ static bool q_show(int vlevel)
         return true;
     }
 
-    if (!is_circular()) {
-        report(vlevel, "ERROR:  Queue is not doubly circular");
-        return false;
+    if (check) {
+        check_t c = {.order = -1};
+        check_result_t r = check_queue(current, false, &c);
+        if (r != CHECK_OK)
+            return report_check(r, current, &c);
     }
 
     report_noreturn(vlevel, "l = [");
@@ -884,16 +1787,13 @@ static bool q_show(int vlevel)
     struct list_head *ori = current->q;
     struct list_head *cur = current->q->next;
 
-    if (exception_setup(true)) {
-        while (ok && ori != cur && cnt < current->size) {
+    if (exception_setup_limit(LIMIT_DEFAULT)) {
+        while (ok && ori != cur && cnt < BIG_LIST_SIZE) {
             element_t *e = list_entry(cur, element_t, list);
-            if (cnt < BIG_LIST_SIZE) {
-                report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
-                if (show_entropy) {
-                    report_noreturn(
-                        vlevel, "(%3.2f%%)",
-                        shannon_entropy((const uint8_t *) e->value));
-                }
+            report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
+            if (show_entropy) {
+                report_noreturn(vlevel, "(%3.2f%%)",
+                                shannon_entropy((const uint8_t *) e->value));
             }
             cnt++;
             cur = cur->next;
@@ -907,21 +1807,42 @@ static bool q_show(int vlevel)
         return false;
     }
 
-    if (cur == ori) {
-        if (cnt <= BIG_LIST_SIZE)
-            report(vlevel, "]");
-        else
-            report(vlevel, " ... ]");
-    } else {
+    if (cur == ori)
+        report(vlevel, "]");
+    else
         report(vlevel, " ... ]");
-        report(vlevel, "ERROR:  Queue has more than %d elements",
-               current->size);
-        ok = false;
-    }
 
     return ok;
 }
 
+/* Check the current queue after a command as 'option verify' asks, then show
+ * it at verbosity 3.  @order is the sort_order_t its values must be in, or -1,
+ * and @unique also forbids equal neighbours.  Without an order, the queue is
+ * only checked when it is going to be shown.
+ */
+static bool q_verify(int order, bool unique)
+{
+    if (!current || !current->q || (order < 0 && verblevel < 3))
+        return q_show(3, false);
+
+    check_t c = {.order = order, .unique = unique};
+    check_result_t r = CHECK_OK;
+    switch (verify_mode) {
+    case VERIFY_OFF:
+        break;
+    case VERIFY_ASYNC:
+        if (!verify_start(current, &c))
+            return false;
+        break;
+    default:
+        r = check_queue(current, verify_mode == VERIFY_SAMPLED, &c);
+        break;
+    }
+    if (r != CHECK_OK)
+        return report_check(r, current, &c);
+    return q_show(3, false);
+}
+
 static bool do_show(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -932,7 +1853,7 @@ static bool do_show(int argc, char *argv[])
     if (current)
         report(1, "Current queue ID: %d", current->id);
 
-    return q_show(0);
+    return q_show(0, true);
 }
 
 static bool do_prev(int argc, char *argv[])
@@ -955,7 +1876,7 @@ static bool do_prev(int argc, char *argv[])
         current = prev ? list_entry(prev, queue_contex_t, chain) : NULL;
     }
 
-    return q_show(0);
+    return q_show(0, true);
 }
 
 static bool do_next(int argc, char *argv[])
@@ -978,7 +1899,7 @@ static bool do_next(int argc, char *argv[])
         current = next ? list_entry(next, queue_contex_t, chain) : NULL;
     }
 
-    return q_show(0);
+    return q_show(0, true);
 }
 
 static void console_init()
@@ -988,12 +1909,14 @@ static void console_init()
     ADD_COMMAND(prev, "Switch to previous queue", "");
     ADD_COMMAND(next, "Switch to next queue", "");
     ADD_COMMAND(ih,
-                "Insert string str at head of queue n times. Generate random "
-                "string(s) if str equals RAND. (default: n == 1)",
+                "Insert string str at head of queue n times. Generate strings "
+                "if str is RAND or a spec such as zipf:1,1000, see gen.h. "
+                "(default: n == 1)",
                 "str [n]");
     ADD_COMMAND(it,
-                "Insert string str at tail of queue n times. Generate random "
-                "string(s) if str equals RAND. (default: n == 1)",
+                "Insert string str at tail of queue n times. Generate strings "
+                "if str is RAND or a spec such as zipf:1,1000, see gen.h. "
+                "(default: n == 1)",
                 "str [n]");
     ADD_COMMAND(
         rh,
@@ -1004,12 +1927,15 @@ static void console_init()
         "Remove from tail of queue. Optionally compare to expected value str",
         "[str]");
     ADD_COMMAND(reverse, "Reverse queue", "");
-    ADD_COMMAND(sort, "Sort queue in ascending order", "");
+    ADD_COMMAND(sort, "Sort queue in the order set by 'option order'", "");
     ADD_COMMAND(size, "Compute queue size n times (default: n == 1)", "[n]");
     ADD_COMMAND(show, "Show queue contents", "");
     ADD_COMMAND(dm, "Delete middle node in queue", "");
     ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
-    ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
+    ADD_COMMAND(merge,
+                "Merge all the queues into one sorted queue, dropping strings "
+                "that occur more than once with 'unique'",
+                "[unique]");
     ADD_COMMAND(swap, "Swap every two adjacent nodes in queue", "");
     ADD_COMMAND(descend,
                 "Remove every node which has a node with a strictly greater "
@@ -1017,12 +1943,105 @@ static void console_init()
                 "");
     ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
                 "[K]");
+    ADD_COMMAND(sortk,
+                "Move the K smallest elements to the front of queue in "
+                "ascending order",
+                "K");
+    ADD_COMMAND(find,
+                "Count the elements holding str. Optionally compare to "
+                "expected count n",
+                "str [n]");
+    ADD_COMMAND(rmval, "Remove an element holding str from queue", "str");
+    ADD_COMMAND(select,
+                "Find the element of rank K (1 == smallest). Optionally "
+                "compare to expected value str",
+                "K [str]");
+    ADD_COMMAND(sortbench,
+                "Run every sort engine on copies of queue and report best "
+                "cycles of n runs, comparisons and correctness (default: n == "
+                "3)",
+                "[n]");
+    ADD_COMMAND(orderbench,
+                "Time specialized sorts in every order against list_sort with "
+                "a comparison function pointer, best of n runs (default: n == "
+                "5)",
+                "[n]");
+    ADD_COMMAND(failat,
+                "Make the allocations numbered n... fail, counting from now; "
+                "no argument cancels",
+                "[n...]");
+    ADD_COMMAND(allocstats,
+                "Show statistics of the test allocator and the allocation "
+                "profile",
+                "");
+    ADD_COMMAND(slotcheck,
+                "Check the harness bookkeeping past 2^32 blocks, without "
+                "allocating them",
+                "");
+    ADD_COMMAND(mtstress,
+                "Insert and remove concurrently in t threads, n operations "
+                "each, then check for leaks (default: t == 4, n == 100000)",
+                "[t] [n]");
+    ADD_COMMAND(cmpbench,
+                "Benchmark string comparison kernels for lengths 8 to "
+                "1024, n calls each (default: n == 100000)",
+                "[n]");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
-              NULL);
+              fault_changed);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
+    add_param("failevery", &fault_every, "Fail every Nth malloc",
+              fault_changed);
+    add_param("failburst", &fault_burst,
+              "Number of mallocs failing in a row once one fails",
+              fault_changed);
+    add_param("failbytes", &fault_after_bytes,
+              "Fail mallocs once this many bytes have been requested",
+              fault_changed);
+    add_param("seed", &fault_seed, "Seed of malloc failure probability",
+              fault_changed);
+    add_param_named("simd", &simd_kind, simd_names,
+                    "String comparison kernel (scalar, sse2, avx2)",
+                    simd_changed);
+    add_param_named("sort", &sort_engine, sort_engine_names,
+                    "Sort engine behind q_sort (bottomup, topdown, linux)",
+                    NULL);
+    add_param_named("order", &sort_order, sort_order_names,
+                    "Sort order (ascend, descend, length, natural)", NULL);
+    add_param("index", &use_index, "Keep a value index in every queue",
+              index_changed);
+    add_param_named("poison", &poison_level, poison_names,
+                    "Block checking by the allocator (off, canary, partial64, "
+                    "full)",
+                    NULL);
+    add_param_named("profile", &alloc_profile, profile_names,
+                    "Profile allocations per call site (off, on, exit)", NULL);
+    add_param("cache", &alloc_cache_enabled,
+              "Reuse freed blocks of up to 256 bytes", cache_changed);
+    add_param("compact", &alloc_compact,
+              "Allocate blocks of up to 256 bytes from an arena without "
+              "headers, unchecked",
+              compact_changed);
+    add_param_range("limit", &time_limits[LIMIT_DEFAULT], 0, INT_MAX,
+                    "Time limit in ms of commands without a limit of their "
+                    "own, none at 0",
+                    NULL);
+    add_param_range("limitins", &time_limits[LIMIT_INSERT], 0, INT_MAX,
+                    "Time limit in ms of ih and it", NULL);
+    add_param_range("limitrm", &time_limits[LIMIT_REMOVE], 0, INT_MAX,
+                    "Time limit in ms of rh, rt, dm and rmval", NULL);
+    add_param_range("limitsort", &time_limits[LIMIT_SORT], 0, INT_MAX,
+                    "Time limit in ms of sort, sortk and merge", NULL);
+    add_param_range("limitwarn", &time_warn_percent, 0, 100,
+                    "Warn when a command uses this percent of its time limit",
+                    NULL);
+    add_param_named("verify", &verify_mode, verify_names,
+                    "Checks after each command (off, sampled, full, async)",
+                    verify_changed);
+    add_param_range("footercheck", &footer_check_interval, 1, INT_MAX,
+                    "Check footer of one in this many freed blocks", NULL);
 }
 
 /* Signal handlers */
@@ -1054,11 +2073,13 @@ static void q_init()
 
 static bool q_quit(int argc, char *argv[])
 {
+    bool ok = verify_wait(NULL);
+
+    if (alloc_profile == PROFILE_EXIT)
+        alloc_profile_report();
     report(3, "Freeing queue");
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
 
-    if (exception_setup(true)) {
+    if (exception_setup_limit(LIMIT_DEFAULT)) {
         struct list_head *cur = chain.head.next;
         while (chain.size > 0) {
             queue_contex_t *qctx, *tmp;
@@ -1071,7 +2092,8 @@ static bool q_quit(int argc, char *argv[])
     }
 
     exception_cancel();
-    set_cautious_mode(true);
+    alloc_cache_flush();
+    gen_release_all();
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
@@ -1080,16 +2102,22 @@ static bool q_quit(int argc, char *argv[])
         return false;
     }
 
-    return true;
+    return ok;
 }
 
 static void usage(char *cmd)
 {
-    printf("Usage: %s [-h] [-f IFILE][-v VLEVEL][-l LFILE]\n", cmd);
+    printf("Usage: %s [-h] [-n] [-f IFILE][-v VLEVEL][-l LFILE]\n", cmd);
+    printf("       %s --compile IFILE -o OFILE\n", cmd);
     printf("\t-h         Print this information\n");
-    printf("\t-f IFILE   Read commands from IFILE\n");
+    printf("\t-f IFILE   Read commands from IFILE, a text or compiled trace\n"
+           "\t           Given several times, run each trace in a child\n");
+    printf("\t-j N       Run up to N traces at a time\n");
+    printf("\t--compile IFILE -o OFILE\n"
+           "\t           Compile text trace IFILE for fast replay with -f\n");
     printf("\t-v VLEVEL  Set verbosity level\n");
     printf("\t-l LFILE   Echo results to LFILE\n");
+    printf("\t-n         Start with no time limits, as under valgrind\n");
     exit(0);
 }
 
@@ -1145,6 +2173,116 @@ uintptr_t os_random(uintptr_t seed)
     return x;
 }
 
+/* Trace run by a child of fork_traces() */
+typedef struct {
+    const char *name;
+    pid_t pid;
+    FILE *out; /* Output of the child */
+    struct timespec start;
+    double seconds;
+    int status;
+    bool done;
+} trace_job_t;
+
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Print the captured output and the result of @job, naming the trace by its
+ * file name without directory and extension, as scripts/driver.py does
+ */
+static void print_trace_result(trace_job_t *job, int level)
+{
+    const char *base = strrchr(job->name, '/');
+    base = base ? base + 1 : job->name;
+    int len = strcspn(base, ".");
+    bool ok = WIFEXITED(job->status) && WEXITSTATUS(job->status) == 0;
+
+    if (level > 0)
+        printf("+++ TESTING trace %.*s:\n", len, base);
+    rewind(job->out);
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), job->out)) > 0)
+        fwrite(chunk, 1, n, stdout);
+    fclose(job->out);
+    if (WIFSIGNALED(job->status))
+        printf("Killed by signal %d\n", WTERMSIG(job->status));
+    printf("---\t%.*s\t%d/1\t%.3f s\n", len, base, ok, job->seconds);
+    fflush(stdout);
+}
+
+/* Run each of the @n traces in @names in a child process, at most @jobs at a
+ * time, printing the output of each with its result in the order given.
+ * Return: in a child, the index of the trace it must run; in the parent -1,
+ * once every child has finished, with the number of failed traces in *@failed
+ */
+static int fork_traces(char **names, int n, int jobs, int level, int *failed)
+{
+    trace_job_t *job = calloc(n, sizeof(trace_job_t));
+    struct timespec wall;
+    int started = 0, running = 0, printed = 0;
+    *failed = 0;
+
+    if (!job) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &wall);
+    while (printed < n) {
+        while (started < n && running < jobs) {
+            trace_job_t *j = &job[started];
+            j->name = names[started];
+            j->out = tmpfile();
+            clock_gettime(CLOCK_MONOTONIC, &j->start);
+            fflush(stdout);
+            j->pid = j->out ? fork() : -1;
+            if (j->pid == 0) {
+                dup2(fileno(j->out), STDOUT_FILENO);
+                dup2(fileno(j->out), STDERR_FILENO);
+                int index = started;
+                free(job);
+                return index;
+            }
+            if (j->pid < 0) {
+                perror("fork");
+                exit(EXIT_FAILURE);
+            }
+            started++;
+            running++;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            perror("wait");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < started; i++) {
+            if (job[i].pid == pid && !job[i].done) {
+                job[i].done = true;
+                job[i].status = status;
+                job[i].seconds = seconds_since(&job[i].start);
+                running--;
+            }
+        }
+        for (; printed < started && job[printed].done; printed++) {
+            print_trace_result(&job[printed], level);
+            if (!WIFEXITED(job[printed].status) ||
+                WEXITSTATUS(job[printed].status))
+                (*failed)++;
+        }
+    }
+
+    printf("---\tTOTAL\t\t%d/%d\t%.3f s\n", n - *failed, n,
+           seconds_since(&wall));
+    free(job);
+    return -1;
+}
+
 #define BUFSIZE 256
 int main(int argc, char *argv[])
 {
@@ -1157,19 +2295,35 @@ int main(int argc, char *argv[])
     char *infile_name = NULL;
     char lbuf[BUFSIZE];
     char *logfile_name = NULL;
+    char *compile_name = NULL, *output_name = NULL;
+    char **infiles = calloc(argc, sizeof(char *));
+    int n_infiles = 0, jobs = 1;
     int level = 4;
     int c;
+    static const struct option long_options[] = {
+        {"compile", required_argument, NULL, 'c'},
+        {NULL, 0, NULL, 0},
+    };
 
-    while ((c = getopt(argc, argv, "hv:f:l:")) != -1) {
+    while ((c = getopt_long(argc, argv, "hv:f:l:no:j:", long_options,
+                            NULL)) != -1) {
         switch (c) {
         case 'h':
             usage(argv[0]);
             break;
         case 'f':
-            strncpy(buf, optarg, BUFSIZE);
-            buf[BUFSIZE - 1] = '\0';
-            infile_name = buf;
+            infiles[n_infiles++] = optarg;
             break;
+        case 'j': {
+            char *endptr;
+            errno = 0;
+            jobs = strtol(optarg, &endptr, 10);
+            if (errno != 0 || endptr == optarg || *endptr || jobs < 1) {
+                fprintf(stderr, "Invalid number of jobs\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
         case 'v': {
             char *endptr;
             errno = 0;
@@ -1185,6 +2339,16 @@ int main(int argc, char *argv[])
             buf[BUFSIZE - 1] = '\0';
             logfile_name = lbuf;
             break;
+        case 'n':
+            for (int cls = 0; cls < N_LIMIT; cls++)
+                time_limits[cls] = 0;
+            break;
+        case 'c':
+            compile_name = optarg;
+            break;
+        case 'o':
+            output_name = optarg;
+            break;
         default:
             printf("Unknown option '%c'\n", c);
             usage(argv[0]);
@@ -1192,12 +2356,35 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (n_infiles > 1 || (n_infiles && jobs > 1)) {
+        int failed;
+        int index = fork_traces(infiles, n_infiles, jobs, level, &failed);
+        if (index < 0)
+            return failed != 0;
+        /* Continue as a child running a single trace */
+        infiles[0] = infiles[index];
+    }
+    if (n_infiles > 0) {
+        strncpy(buf, infiles[0], BUFSIZE);
+        buf[BUFSIZE - 1] = '\0';
+        infile_name = buf;
+    }
+    free(infiles);
+
+    if (compile_name) {
+        if (!output_name)
+            usage(argv[0]);
+        set_verblevel(level);
+        return !compile_trace(compile_name, output_name);
+    }
+
     /* A better seed can be obtained by combining getpid() and its parent ID
      * with the Unix time.
      */
     srand(os_random(getpid() ^ getppid()));
 
     q_init();
+    simd_kind = fastcmp_select(-1);
     init_cmd();
     console_init();
 
@@ -1217,6 +2404,7 @@ int main(int argc, char *argv[])
         set_logfile(logfile_name);
 
     add_quit_helper(q_quit);
+    set_pre_cmd_helper(verify_helper);
 
     bool ok = true;
     ok = ok && run_console(infile_name);
@@ -1,8 +1,11 @@
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "fastcmp.h"
 #include "queue.h"
+#include "sort.h"
 
 /* Notice: sometimes, Cppcheck would find the potential NULL pointer bugs,
  * but some of them cannot occur. You can suppress them by adding the
@@ -10,280 +13,145 @@
  *   cppcheck-suppress nullPointer
  */
 
-/*
- * define `USE_LINUX_SORT` at compile time if you want to use the `list_sort`
- * function implemented in linux as q_sort
- */
-#ifdef USE_LINUX_SORT
+/* Header of every queue returned by q_new(); callers only see @head */
+typedef struct {
+    struct list_head head;
+    bool sorted; /* Known to be in ascending order */
+    /* Optional index by value: element_t.hash is chained into the bucket of
+     * its string while the index is on, and points to itself otherwise.
+     */
+    struct list_head *buckets;
+    size_t n_buckets; /* Power of 2, 0 when there is no index */
+    size_t n_indexed;
+} queue_t;
 
-typedef int
-    __attribute__((nonnull(2, 3))) (*list_cmp_func_t)(void *,
-                                                      const struct list_head *,
-                                                      const struct list_head *);
+#define INDEX_MIN_BUCKETS 64
 
-int sort_cmp(void *priv, const struct list_head *a, const struct list_head *b)
+static inline queue_t *to_queue(struct list_head *head)
 {
-    const char *a_val = list_entry(a, element_t, list)->value;
-    const char *b_val = list_entry(b, element_t, list)->value;
-    return strcmp(a_val, b_val);
+    return container_of(head, queue_t, head);
 }
 
-/*
- * Returns a list organized in an intermediate format suited
- * to chaining of merge() calls: null-terminated, no reserved or
- * sentinel head node, "prev" links not maintained.
- */
-__attribute__((nonnull(2, 3, 4))) static struct list_head *
-merge(void *priv, list_cmp_func_t cmp, struct list_head *a, struct list_head *b)
-{
-    struct list_head *head = NULL, **tail = &head;
-
-    for (;;) {
-        /* if equal, take 'a' -- important for sort stability */
-        if (cmp(priv, a, b) <= 0) {
-            *tail = a;
-            tail = &a->next;
-            a = a->next;
-            if (!a) {
-                *tail = b;
-                break;
-            }
-        } else {
-            *tail = b;
-            tail = &b->next;
-            b = b->next;
-            if (!b) {
-                *tail = a;
-                break;
-            }
-        }
-    }
-    return head;
+/* 64-bit FNV-1a */
+static inline uint64_t hash_str(const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; s++)
+        h = (h ^ (unsigned char) *s) * 0x100000001b3ULL;
+    return h;
 }
 
-/*
- * Combine final list merge with restoration of standard doubly-linked
- * list structure.  This approach duplicates code from merge(), but
- * runs faster than the tidier alternatives of either a separate final
- * prev-link restoration pass, or maintaining the prev links
- * throughout.
+static inline struct list_head *bucket_of(queue_t *q, const char *s)
+{
+    return &q->buckets[hash_str(s) & (q->n_buckets - 1)];
+}
+
+/* Rehash the index of @q into @n buckets.  On allocation failure the old
+ * table is kept, which only costs speed.
  */
-__attribute__((nonnull(2, 3, 4, 5))) static void merge_final(
-    void *priv,
-    list_cmp_func_t cmp,
-    struct list_head *head,
-    struct list_head *a,
-    struct list_head *b)
-{
-    struct list_head *tail = head;
-    unsigned int count = 0;
-
-    for (;;) {
-        /* if equal, take 'a' -- important for sort stability */
-        if (cmp(priv, a, b) <= 0) {
-            tail->next = a;
-            a->prev = tail;
-            tail = a;
-            a = a->next;
-            if (!a)
-                break;
-        } else {
-            tail->next = b;
-            b->prev = tail;
-            tail = b;
-            b = b->next;
-            if (!b) {
-                b = a;
-                break;
-            }
-        }
+static bool index_resize(queue_t *q, size_t n)
+{
+    struct list_head *buckets = malloc(n * sizeof(struct list_head));
+    if (!buckets)
+        return false;
+    for (size_t i = 0; i < n; i++)
+        INIT_LIST_HEAD(&buckets[i]);
+
+    struct list_head *old = q->buckets;
+    size_t old_n = q->n_buckets;
+    q->buckets = buckets;
+    q->n_buckets = n;
+    for (size_t i = 0; i < old_n; i++) {
+        element_t *e, *safe;
+        list_for_each_entry_safe (e, safe, &old[i], hash)
+            list_move_tail(&e->hash, bucket_of(q, e->value));
     }
+    free(old);
+    return true;
+}
 
-    /* Finish linking remainder of list b on to tail */
-    tail->next = b;
-    do {
-        /*
-         * If the merge is highly unbalanced (e.g. the input is
-         * already sorted), this loop may run many iterations.
-         * Continue callbacks to the client even though no
-         * element comparison is needed, so the client's cmp()
-         * routine can invoke cond_resched() periodically.
-         */
-        if (!++count)
-            cmp(priv, b, b);
-        b->prev = tail;
-        tail = b;
-        b = b->next;
-    } while (b);
-
-    /* And the final links to make a circular doubly-linked list */
-    tail->next = head;
-    head->prev = tail;
-}
-
-/**
- * list_sort - sort a list
- * @priv: private data, opaque to list_sort(), passed to @cmp
- * @head: the list to sort
- * @cmp: the elements comparison function
- *
- * The comparison function @cmp must return > 0 if @a should sort after
- * @b ("@a > @b" if you want an ascending sort), and <= 0 if @a should
- * sort before @b *or* their original order should be preserved.  It is
- * always called with the element that came first in the input in @a,
- * and list_sort is a stable sort, so it is not necessary to distinguish
- * the @a < @b and @a == @b cases.
- *
- * This is compatible with two styles of @cmp function:
- * - The traditional style which returns <0 / =0 / >0, or
- * - Returning a boolean 0/1.
- * The latter offers a chance to save a few cycles in the comparison
- * (which is used by e.g. plug_ctx_cmp() in block/blk-mq.c).
- *
- * A good way to write a multi-word comparison is::
- *
- *	if (a->high != b->high)
- *		return a->high > b->high;
- *	if (a->middle != b->middle)
- *		return a->middle > b->middle;
- *	return a->low > b->low;
- *
- *
- * This mergesort is as eager as possible while always performing at least
- * 2:1 balanced merges.  Given two pending sublists of size 2^k, they are
- * merged to a size-2^(k+1) list as soon as we have 2^k following elements.
- *
- * Thus, it will avoid cache thrashing as long as 3*2^k elements can
- * fit into the cache.  Not quite as good as a fully-eager bottom-up
- * mergesort, but it does use 0.2*n fewer comparisons, so is faster in
- * the common case that everything fits into L1.
- *
- *
- * The merging is controlled by "count", the number of elements in the
- * pending lists.  This is beautifully simple code, but rather subtle.
- *
- * Each time we increment "count", we set one bit (bit k) and clear
- * bits k-1 .. 0.  Each time this happens (except the very first time
- * for each bit, when count increments to 2^k), we merge two lists of
- * size 2^k into one list of size 2^(k+1).
- *
- * This merge happens exactly when the count reaches an odd multiple of
- * 2^k, which is when we have 2^k elements pending in smaller lists,
- * so it's safe to merge away two lists of size 2^k.
- *
- * After this happens twice, we have created two lists of size 2^(k+1),
- * which will be merged into a list of size 2^(k+2) before we create
- * a third list of size 2^(k+1), so there are never more than two pending.
- *
- * The number of pending lists of size 2^k is determined by the
- * state of bit k of "count" plus two extra pieces of information:
- *
- * - The state of bit k-1 (when k == 0, consider bit -1 always set), and
- * - Whether the higher-order bits are zero or non-zero (i.e.
- *   is count >= 2^(k+1)).
- *
- * There are six states we distinguish.  "x" represents some arbitrary
- * bits, and "y" represents some arbitrary non-zero bits:
- * 0:  00x: 0 pending of size 2^k;           x pending of sizes < 2^k
- * 1:  01x: 0 pending of size 2^k; 2^(k-1) + x pending of sizes < 2^k
- * 2: x10x: 0 pending of size 2^k; 2^k     + x pending of sizes < 2^k
- * 3: x11x: 1 pending of size 2^k; 2^(k-1) + x pending of sizes < 2^k
- * 4: y00x: 1 pending of size 2^k; 2^k     + x pending of sizes < 2^k
- * 5: y01x: 2 pending of size 2^k; 2^(k-1) + x pending of sizes < 2^k
- * (merge and loop back to state 2)
- *
- * We gain lists of size 2^k in the 2->3 and 4->5 transitions (because
- * bit k-1 is set while the more significant bits are non-zero) and
- * merge them away in the 5->2 transition.  Note in particular that just
- * before the 5->2 transition, all lower-order bits are 11 (state 3),
- * so there is one list of each smaller size.
- *
- * When we reach the end of the input, we merge all the pending
- * lists, from smallest to largest.  If you work through cases 2 to
- * 5 above, you can see that the number of elements we merge with a list
- * of size 2^k varies from 2^(k-1) (cases 3 and 5 when x == 0) to
- * 2^(k+1) - 1 (second merge of case 5 when x == 2^(k-1) - 1).
+/* Grow the index of @q to at least one bucket per element, in one rehash
+ * however far behind it is
  */
-__attribute__((nonnull(2, 3))) void list_sort(void *priv,
-                                              struct list_head *head,
-                                              list_cmp_func_t cmp)
+static void index_fit(queue_t *q)
 {
-    struct list_head *list = head->next, *pending = NULL;
-    size_t count = 0; /* Count of pending */
+    size_t n = q->n_buckets;
+    if (!n || q->n_indexed <= n)
+        return;
+    while (n < q->n_indexed)
+        n *= 2;
+    index_resize(q, n);
+}
 
-    if (list == head->prev) /* Zero or one elements */
+static inline void index_add(queue_t *q, element_t *e)
+{
+    if (!q->n_buckets)
         return;
+    list_add_tail(&e->hash, bucket_of(q, e->value));
+    q->n_indexed++;
+    index_fit(q);
+}
 
-    /* Convert to a null-terminated singly-linked list. */
-    head->prev->next = NULL;
-
-    /*
-     * Data structure invariants:
-     * - All lists are singly linked and null-terminated; prev
-     *   pointers are not maintained.
-     * - pending is a prev-linked "list of lists" of sorted
-     *   sublists awaiting further merging.
-     * - Each of the sorted sublists is power-of-two in size.
-     * - Sublists are sorted by size and age, smallest & newest at front.
-     * - There are zero to two sublists of each size.
-     * - A pair of pending sublists are merged as soon as the number
-     *   of following pending elements equals their size (i.e.
-     *   each time count reaches an odd multiple of that size).
-     *   That ensures each later final merge will be at worst 2:1.
-     * - Each round consists of:
-     *   - Merging the two sublists selected by the highest bit
-     *     which flips when count is incremented, and
-     *   - Adding an element from the input as a size-1 sublist.
-     */
-    do {
-        size_t bits;
-        struct list_head **tail = &pending;
-
-        /* Find the least-significant clear bit in count */
-        for (bits = count; bits & 1; bits >>= 1)
-            tail = &(*tail)->prev;
-        /* Do the indicated merge */
-        if (bits) {
-            struct list_head *a = *tail, *b = a->prev;
-
-            a = merge(priv, cmp, b, a);
-            /* Install the merged result in place of the inputs */
-            a->prev = b->prev;
-            *tail = a;
-        }
+static inline void index_del(queue_t *q, element_t *e)
+{
+    if (q->n_buckets)
+        q->n_indexed--;
+    list_del_init(&e->hash);
+}
 
-        /* Move one element from input list to pending */
-        list->prev = pending;
-        pending = list;
-        list = list->next;
-        pending->next = NULL;
-        count++;
-    } while (list);
-
-    /* End of input; merge together all the pending lists. */
-    list = pending;
-    pending = pending->prev;
-    for (;;) {
-        struct list_head *next = pending->prev;
-
-        if (!next)
-            break;
-        list = merge(priv, cmp, pending, list);
-        pending = next;
+/* Move the index entries of all elements of @src to @dst, which is about to
+ * receive them.  Only relinks nodes, so it never allocates: q_merge() must
+ * not, so the buckets of @dst are left to index_fit(), which the next
+ * insertion or q_index() calls.  Lookups never resize; until then they only
+ * walk longer chains.
+ */
+static void index_transfer(queue_t *dst, queue_t *src)
+{
+    if (!dst->n_buckets && !src->n_buckets)
+        return;
+    element_t *e;
+    list_for_each_entry (e, &src->head, list) {
+        list_del_init(&e->hash);
+        if (dst->n_buckets)
+            list_add_tail(&e->hash, bucket_of(dst, e->value));
     }
-    /* The final merge, rebuilding prev links */
-    merge_final(priv, cmp, head, pending, list);
+    if (dst->n_buckets)
+        dst->n_indexed += q_size(&src->head);
+    src->n_indexed = 0;
+}
+
+/* Unlink element from queue and its index, then free it */
+static inline void drop_elem(queue_t *q, element_t *e)
+{
+    list_del(&e->list);
+    index_del(q, e);
+    q_release_element(e);
 }
-#endif /* USE_LINUX_SORT */
 
 /* Create an empty queue */
 struct list_head *q_new()
 {
-    struct list_head *head =
-        (struct list_head *) malloc(sizeof(struct list_head));
+    queue_t *q = (queue_t *) malloc(sizeof(queue_t));
+    if (!q)
+        return NULL;
+    INIT_LIST_HEAD(&q->head);
+    q->sorted = true;
+    q->buckets = NULL;
+    q->n_buckets = q->n_indexed = 0;
+    return &q->head;
+}
+
+/* Check whether queue is known to be sorted */
+bool q_is_sorted(struct list_head *head)
+{
+    return head && to_queue(head)->sorted;
+}
+
+/* Record whether queue is in ascending order */
+void q_set_sorted(struct list_head *head, bool sorted)
+{
     if (head)
-        INIT_LIST_HEAD(head);
-    return head;
+        to_queue(head)->sorted = sorted;
 }
 
 /* Free all storage used by queue */
@@ -297,7 +165,8 @@ void q_free(struct list_head *l)
         list_del(node);
         q_release_element(entry);
     }
-    free(l);
+    free(to_queue(l)->buckets);
+    free(to_queue(l));
 }
 
 static inline element_t *new_elem(char *s)
@@ -315,6 +184,7 @@ static inline element_t *new_elem(char *s)
 
     memcpy(entry->value, s, cplen);
     INIT_LIST_HEAD(&entry->list);
+    INIT_LIST_HEAD(&entry->hash);
     return entry;
 }
 
@@ -324,9 +194,16 @@ bool q_insert_head(struct list_head *head, char *s)
     if (!head)
         return false;
     element_t *entry = new_elem(s);
-    if (entry)
-        list_add(&entry->list, head);
-    return !!entry;
+    if (!entry)
+        return false;
+    /* Sorted stays sorted if the new string is not above the first one */
+    queue_t *q = to_queue(head);
+    if (q->sorted && !list_empty(head))
+        q->sorted = fast_strcmp(
+                        s, list_first_entry(head, element_t, list)->value) <= 0;
+    list_add(&entry->list, head);
+    index_add(q, entry);
+    return true;
 }
 
 /* Insert an element at tail of queue */
@@ -335,14 +212,24 @@ bool q_insert_tail(struct list_head *head, char *s)
     if (!head)
         return false;
     element_t *entry = new_elem(s);
-    if (entry)
-        list_add_tail(&entry->list, head);
-    return !!entry;
+    if (!entry)
+        return false;
+    queue_t *q = to_queue(head);
+    if (q->sorted && !list_empty(head))
+        q->sorted = fast_strcmp(
+                        s, list_last_entry(head, element_t, list)->value) >= 0;
+    list_add_tail(&entry->list, head);
+    index_add(q, entry);
+    return true;
 }
 
-static inline void remove_elem(element_t *node, char *sp, size_t bufsize)
+static inline void remove_elem(queue_t *q,
+                               element_t *node,
+                               char *sp,
+                               size_t bufsize)
 {
     list_del_init(&node->list);
+    index_del(q, node);
     if (!sp)
         return;
     size_t cplen = strlen(node->value) + 1;
@@ -356,7 +243,7 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
     if (!head || list_empty(head))
         return NULL;
     element_t *entry = list_first_entry(head, element_t, list);
-    remove_elem(entry, sp, bufsize);
+    remove_elem(to_queue(head), entry, sp, bufsize);
     return entry;
 }
 
@@ -366,16 +253,107 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
     if (!head || list_empty(head))
         return NULL;
     element_t *entry = list_last_entry(head, element_t, list);
-    remove_elem(entry, sp, bufsize);
+    remove_elem(to_queue(head), entry, sp, bufsize);
     return entry;
 }
 
+/* Turn the value index of queue on or off */
+bool q_index(struct list_head *head, bool enable)
+{
+    if (!head)
+        return false;
+    queue_t *q = to_queue(head);
+    element_t *e;
+    if (!enable) {
+        list_for_each_entry (e, head, list)
+            INIT_LIST_HEAD(&e->hash);
+        free(q->buckets);
+        q->buckets = NULL;
+        q->n_buckets = q->n_indexed = 0;
+        return true;
+    }
+    if (q->n_buckets) {
+        index_fit(q);
+        return true;
+    }
+
+    size_t size = q_size(head), n = INDEX_MIN_BUCKETS;
+    while (n < size)
+        n *= 2;
+    if (!index_resize(q, n))
+        return false;
+    list_for_each_entry (e, head, list)
+        list_add_tail(&e->hash, bucket_of(q, e->value));
+    q->n_indexed = size;
+    return true;
+}
+
+/* Check whether queue has the value index on */
+bool q_is_indexed(struct list_head *head)
+{
+    return head && to_queue(head)->n_buckets;
+}
+
+/* Find an element holding @s, NULL if there is none */
+static element_t *find_value(struct list_head *head, const char *s)
+{
+    queue_t *q = to_queue(head);
+    element_t *e;
+    if (q->n_buckets) {
+        list_for_each_entry (e, bucket_of(q, s), hash)
+            if (!fast_strcmp(e->value, s))
+                return e;
+    } else {
+        list_for_each_entry (e, head, list)
+            if (!fast_strcmp(e->value, s))
+                return e;
+    }
+    return NULL;
+}
+
+/* Check whether any element of queue holds the string */
+bool q_contains(struct list_head *head, const char *s)
+{
+    return head && s && find_value(head, s);
+}
+
+/* Count the elements of queue holding the string */
+size_t q_count(struct list_head *head, const char *s)
+{
+    if (!head || !s)
+        return 0;
+    queue_t *q = to_queue(head);
+    struct list_head *chain = q->n_buckets ? bucket_of(q, s) : head;
+    struct list_head *node;
+    size_t count = 0;
+    list_for_each (node, chain) {
+        element_t *e = q->n_buckets ? list_entry(node, element_t, hash)
+                                    : list_entry(node, element_t, list);
+        count += !fast_strcmp(e->value, s);
+    }
+    return count;
+}
+
+/* Remove an element holding the string from queue */
+element_t *q_remove_value(struct list_head *head,
+                          const char *s,
+                          char *sp,
+                          size_t bufsize)
+{
+    if (!head || !s)
+        return NULL;
+    element_t *e = find_value(head, s);
+    if (e)
+        remove_elem(to_queue(head), e, sp, bufsize);
+    return e;
+}
+
 /* Return number of elements in queue */
-int q_size(struct list_head *head)
+size_t q_size(struct list_head *head)
 {
     if (!head || list_empty(head))
         return 0;
-    int size = 0;
+    size_t size = 0;
     struct list_head *node;
     list_for_each (node, head)
         size += 1;
@@ -393,9 +371,7 @@ bool q_delete_mid(struct list_head *head)
         fw = fw->next;
         bw = bw->prev;
     }
-    list_del(fw);
-    element_t *tmp = list_entry(fw, element_t, list);
-    q_release_element(tmp);
+    drop_elem(to_queue(head), list_entry(fw, element_t, list));
     return true;
 }
 
@@ -405,23 +381,22 @@ bool q_delete_dup(struct list_head *head)
     // https://leetcode.com/problems/remove-duplicates-from-sorted-list-ii/
     if (!head)
         return false;
+    queue_t *q = to_queue(head);
     element_t *entry, *next;
     char *del_val = NULL;
     list_for_each_entry_safe (entry, next, head, list) {
-        if (del_val && !strcmp(entry->value, del_val)) {
-            list_del(&entry->list);
-            q_release_element(entry);
+        if (del_val && !fast_strcmp(entry->value, del_val)) {
+            drop_elem(q, entry);
             continue;
         }
         if (del_val) {
             free(del_val);
             del_val = NULL;
         }
-        if (&next->list != head && !strcmp(entry->value, next->value)) {
+        if (&next->list != head && !fast_strcmp(entry->value, next->value)) {
             del_val = entry->value;
             entry->value = NULL;
-            list_del(&entry->list);
-            q_release_element(entry);
+            drop_elem(q, entry);
         }
     }
     free(del_val);
@@ -444,171 +419,384 @@ void q_swap(struct list_head *head)
             list_del_init(node);
         }
     }
+    to_queue(head)->sorted = list_is_singular(head);
 }
 
-/* Reverse elements in queue */
-void q_reverse(struct list_head *head)
+static void reverse_list(struct list_head *head)
 {
-    if (!head || list_empty(head))
-        return;
     struct list_head *node, *safe;
     list_for_each_safe (node, safe, head) {
         list_move(node, head);
     }
 }
 
+/* Reverse elements in queue */
+void q_reverse(struct list_head *head)
+{
+    if (!head || list_empty(head))
+        return;
+    reverse_list(head);
+    to_queue(head)->sorted = list_is_singular(head);
+}
+
 /* Reverse the nodes of the list k at a time */
-void q_reverseK(struct list_head *head, int k)
+void q_reverseK(struct list_head *head, size_t k)
 {
     // https://leetcode.com/problems/reverse-nodes-in-k-group/
     if (!head || list_empty(head) || k < 2)
         return;
     LIST_HEAD(tmp);
     struct list_head *cur, *safe, *sub_st = head;
-    int cnt = 0;
+    size_t cnt = 0;
     list_for_each_safe (cur, safe, head) {
         cnt += 1;
         if (cnt == k) {
             list_cut_position(&tmp, sub_st, cur);
-            q_reverse(&tmp);
+            reverse_list(&tmp);
             list_splice_init(&tmp, sub_st);
             cnt = 0;
             sub_st = safe->prev;
+            to_queue(head)->sorted = false;
         }
     }
 }
 
-/* get the cut point in @head until which the value is smaller than @s */
-static struct list_head *get_cut(struct list_head *head, char *s)
+/* Sort elements of queue in ascending order */
+void q_sort(struct list_head *head)
 {
-    element_t *entry = NULL, *safe = NULL;
-    list_for_each_entry_safe (entry, safe, head, list) {
-        if (strcmp(entry->value, s) > 0)
+    if (!head || to_queue(head)->sorted)
+        return;
+    sort_engines[sort_engine].sort(head);
+    to_queue(head)->sorted = true;
+}
+
+/* Restore max-heap order below @i among the first @n entries of @heap */
+static void heap_sift_down(element_t **heap, size_t n, size_t i)
+{
+    element_t *e = heap[i];
+    for (size_t child; (child = 2 * i + 1) < n; i = child) {
+        if (child + 1 < n &&
+            fast_strcmp(heap[child + 1]->value, heap[child]->value) > 0)
+            child++;
+        if (fast_strcmp(heap[child]->value, e->value) <= 0)
             break;
+        heap[i] = heap[child];
     }
-    entry = list_entry(entry->list.prev, element_t, list);
-    return &entry->list;
+    heap[i] = e;
 }
 
-/* merge two list and return the total node amount */
-static void merge_two_list(struct list_head *l1,
-                           struct list_head *l2,
-                           struct list_head *dest)
+/* Fill @heap with the @k smallest elements of @head, the largest of them at
+ * heap[0].  @head must hold at least @k elements.
+ */
+static void heap_smallest_k(struct list_head *head,
+                            element_t **heap,
+                            size_t k)
 {
-    if (!l2 || list_empty(l2)) {
-        list_splice_init(l1, dest);
-        return;
+    struct list_head *node = head->next;
+    for (size_t i = 0; i < k; i++, node = node->next)
+        heap[i] = list_entry(node, element_t, list);
+    for (size_t i = k / 2; i-- > 0;)
+        heap_sift_down(heap, k, i);
+
+    for (; node != head; node = node->next) {
+        element_t *e = list_entry(node, element_t, list);
+        if (fast_strcmp(e->value, heap[0]->value) < 0) {
+            heap[0] = e;
+            heap_sift_down(heap, k, 0);
+        }
     }
-    LIST_HEAD(tmp);
-    struct list_head *lists[2] = {l1, l2};
-    struct list_head *cut = NULL;
-    int flag = 0;
-    while (!list_empty(l1) && !list_empty(l2)) {
-        cut = get_cut(lists[flag],
-                      list_first_entry(lists[!flag], element_t, list)->value);
-        list_cut_position(&tmp, lists[flag], cut);
-        list_splice_tail_init(&tmp, dest);
-        flag = !flag;
+}
+
+/* Sort the k smallest elements to the front of queue */
+bool q_sort_k(struct list_head *head, size_t k)
+{
+    if (!head)
+        return false;
+    if (!k || to_queue(head)->sorted)
+        return true;
+    if (k >= q_size(head)) {
+        q_sort(head);
+        return true;
     }
-    for (int i = 0; i < 2; i++) {
-        list_splice_tail_init(lists[i], dest);
+
+    element_t **heap = malloc(k * sizeof(element_t *));
+    if (!heap)
+        return false;
+    heap_smallest_k(head, heap, k);
+
+    /* Popping the maximum k times yields the front of queue back to front */
+    for (size_t n = k; n > 0; n--) {
+        element_t *max = heap[0];
+        heap[0] = heap[n - 1];
+        heap_sift_down(heap, n - 1, 0);
+        list_move(&max->list, head);
     }
+    free(heap);
+    return true;
 }
-/* Sort elements of queue in ascending order */
-void q_sort(struct list_head *head)
-{
-#ifndef USE_LINUX_SORT
-    if (list_empty(head) || list_is_singular(head))
-        return;
 
-    LIST_HEAD(h1);
-    LIST_HEAD(h2);
-    struct list_head *fw = head->next, *bw = head->prev;
-    while (fw != bw && fw->next != bw) {
-        fw = fw->next;
-        bw = bw->prev;
+/* Find the k-th smallest element */
+element_t *q_select(struct list_head *head, size_t k)
+{
+    if (!head || !k || k > q_size(head))
+        return NULL;
+    if (to_queue(head)->sorted) {
+        struct list_head *node = head;
+        while (k--)
+            node = node->next;
+        return list_entry(node, element_t, list);
     }
-    list_cut_position(&h2, head, fw);
-    list_splice_init(head, &h1);
-    q_sort(&h1);
-    q_sort(&h2);
-    merge_two_list(&h1, &h2, head);
-#else
-    list_sort(NULL, head, sort_cmp);
-#endif
+
+    element_t **heap = malloc(k * sizeof(element_t *));
+    if (!heap)
+        return NULL;
+    heap_smallest_k(head, heap, k);
+    element_t *kth = heap[0];
+    free(heap);
+    return kth;
 }
 
 /* Remove every node which has a node with a strictly greater value anywhere to
  * the right side of it */
-int q_descend(struct list_head *head)
+size_t q_descend(struct list_head *head)
 {
     // https://leetcode.com/problems/remove-nodes-from-linked-list/
     char *max = NULL;
     element_t *entry = NULL, *safe = NULL;
-    int total = 0, n_del = 0;
+    size_t total = 0, n_del = 0;
     for (entry = list_entry(head->prev, element_t, list),
         safe = list_entry(entry->list.prev, element_t, list);
          &entry->list != head;
          entry = safe, safe = list_entry(safe->list.prev, element_t, list)) {
         total += 1;
-        if (!max || strcmp(entry->value, max) > 0) {
+        if (!max || fast_strcmp(entry->value, max) > 0) {
             max = entry->value;
         } else {
-            list_del(&entry->list);
-            q_release_element(entry);
+            drop_elem(to_queue(head), entry);
             n_del += 1;
         }
     }
+    /* What is left never increases, so it is ascending only if constant */
+    if (total)
+        to_queue(head)->sorted =
+            !fast_strcmp(list_first_entry(head, element_t, list)->value,
+                         list_last_entry(head, element_t, list)->value);
     return total - n_del;
 }
 
-
+static int ctx_size_cmp(void *priv,
+                        const struct list_head *a,
+                        const struct list_head *b)
+{
+    size_t na = list_entry(a, queue_contex_t, chain)->size;
+    size_t nb = list_entry(b, queue_contex_t, chain)->size;
+    return (na > nb) - (na < nb);
+}
 
 /* Merge all the queues into one sorted queue, which is in ascending order */
-int q_merge(struct list_head *head)
+size_t q_merge(struct list_head *head)
 {
     // https://leetcode.com/problems/merge-k-sorted-lists/
+    if (!head || list_empty(head))
+        return 0;
+    queue_contex_t *first = list_first_entry(head, queue_contex_t, chain);
     if (list_is_singular(head))
-        return list_entry(head, queue_contex_t, chain)->size;
+        return first->size;
+
+    /* The result is only known to be sorted if every input was */
+    bool sorted = true;
+    queue_contex_t *ctx;
+    list_for_each_entry (ctx, head, chain) {
+        sorted = sorted && to_queue(ctx->q)->sorted;
+        if (ctx != first)
+            index_transfer(to_queue(first->q), to_queue(ctx->q));
+    }
 
+    /* Always merge the two shortest queues, as in building a Huffman tree,
+     * so a long queue is not copied over again in every round while short
+     * ones are folded in.  The chain itself is kept ordered by size and
+     * serves as the priority queue; emptied contexts are parked in @done.
+     */
+    LIST_HEAD(done);
     LIST_HEAD(q_tmp);
-    struct list_head *dest = head->next, *end = head;
-    struct list_head *merge_p = head->next;
-    queue_contex_t *q1 = NULL, *q2 = NULL, *q_dest = NULL;
-    int size_tmp;
-    while (end != merge_p->next) {
-        while (merge_p != end && merge_p->next != end) {
-            q1 = list_entry(merge_p, queue_contex_t, chain);
-            q2 = list_entry(merge_p->next, queue_contex_t, chain);
-            q_dest = list_entry(dest, queue_contex_t, chain);
-
-            merge_two_list(q1->q, q2->q, &q_tmp);
-            size_tmp = q1->size + q2->size;
-            q1->size = q2->size = 0;
-
-            list_splice_init(&q_tmp, q_dest->q);
-            q_dest->size = size_tmp;
-
-            merge_p = merge_p->next->next;
-            dest = dest->next;
+    list_sort(NULL, head, ctx_size_cmp);
+    while (!list_is_singular(head)) {
+        queue_contex_t *q1 = list_first_entry(head, queue_contex_t, chain);
+        queue_contex_t *q2 =
+            list_entry(q1->chain.next, queue_contex_t, chain);
+
+        merge_two_list(q1->q, q2->q, &q_tmp);
+        list_splice_init(&q_tmp, q2->q);
+        q2->size += q1->size;
+        q1->size = 0;
+        list_move_tail(&q1->chain, &done);
+
+        /* Sink the merged queue to its place among the pending ones */
+        struct list_head *pos = q2->chain.next;
+        while (pos != head &&
+               list_entry(pos, queue_contex_t, chain)->size < q2->size)
+            pos = pos->next;
+        list_move_tail(&q2->chain, pos);
+    }
+
+    /* Hand the result to the context which came first in the chain */
+    queue_contex_t *result = list_first_entry(head, queue_contex_t, chain);
+    list_splice_tail_init(&done, head);
+    list_move(&first->chain, head);
+    if (result != first) {
+        list_splice_init(result->q, first->q);
+        first->size = result->size;
+        result->size = 0;
+    }
+
+    list_for_each_entry (ctx, head, chain)
+        to_queue(ctx->q)->sorted = ctx != first || sorted;
+    return first->size;
+}
+
+static inline const char *head_value(struct list_head *q)
+{
+    return list_first_entry(q, element_t, list)->value;
+}
+
+/* Order queue heads by their first element, smallest at the top */
+static void qheap_sift_down(struct list_head **heap, size_t n, size_t i)
+{
+    struct list_head *q = heap[i];
+    const char *val = head_value(q);
+    for (size_t child; (child = 2 * i + 1) < n; i = child) {
+        const char *cval = head_value(heap[child]);
+        if (child + 1 < n) {
+            const char *rval = head_value(heap[child + 1]);
+            if (fast_strcmp(rval, cval) < 0) {
+                child++;
+                cval = rval;
+            }
         }
-        if (merge_p != end) {
-            q1 = list_entry(merge_p, queue_contex_t, chain);
-            q_dest = list_entry(dest, queue_contex_t, chain);
+        if (fast_strcmp(cval, val) >= 0)
+            break;
+        heap[i] = heap[child];
+    }
+    heap[i] = q;
+}
+
+/* Append @cand to @result, or release it if it was duplicated.
+ * Return: the number of elements appended
+ */
+static size_t settle_cand(queue_t *q,
+                          element_t *cand,
+                          bool dup,
+                          struct list_head *result)
+{
+    if (!cand)
+        return 0;
+    if (dup) {
+        index_del(q, cand);
+        q_release_element(cand);
+        return 0;
+    }
+    list_add_tail(&cand->list, result);
+    return 1;
+}
 
-            size_tmp = q1->size;
-            q1->size = 0;
+/* Merge all the queues into one sorted queue without duplicate strings */
+size_t q_merge_unique(struct list_head *head)
+{
+    if (!head || list_empty(head))
+        return 0;
 
-            list_splice_init(q1->q, q_dest->q);
-            q_dest->size = size_tmp;
+    size_t k = 0;
+    bool sorted = true;
+    queue_contex_t *ctx, *first = list_first_entry(head, queue_contex_t, chain);
+    queue_t *qf = to_queue(first->q);
+    list_for_each_entry (ctx, head, chain) {
+        sorted = sorted && to_queue(ctx->q)->sorted;
+        if (ctx != first)
+            index_transfer(qf, to_queue(ctx->q));
+        k++;
+    }
 
-            dest = dest->next;
-            merge_p = merge_p->next;
+    struct list_head **heap = malloc(k * sizeof(struct list_head *));
+    if (!heap) {
+        q_merge(head);
+        q_delete_dup(first->q);
+        first->size = q_size(first->q);
+        return first->size;
+    }
+
+    size_t n = 0;
+    list_for_each_entry (ctx, head, chain) {
+        if (ctx->q && !list_empty(ctx->q))
+            heap[n++] = ctx->q;
+        ctx->size = 0;
+        q_set_sorted(ctx->q, true);
+    }
+    for (size_t i = n / 2; i-- > 0;)
+        qheap_sift_down(heap, n, i);
+
+    /* The most recent distinct value waits in @cand until the next one shows
+     * up, since only then is it known whether it was duplicated.  The queue
+     * at the top of the heap gives up a whole run, up to the smallest head
+     * of the others, which is found once per run rather than per node.
+     */
+    LIST_HEAD(result);
+    element_t *cand = NULL;
+    bool cand_dup = false;
+    size_t size = 0;
+    while (n > 0) {
+        struct list_head *q = heap[0];
+        size_t c = 0;
+        const char *stop = NULL;
+        if (n > 1) {
+            c = n > 2 && fast_strcmp(head_value(heap[2]),
+                                     head_value(heap[1])) < 0
+                    ? 2
+                    : 1;
+            stop = head_value(heap[c]);
+        }
+
+        bool same = cand && !fast_strcmp(head_value(q), cand->value);
+        for (;;) {
+            element_t *e = list_first_entry(q, element_t, list);
+            list_del(&e->list);
+            if (same) {
+                index_del(qf, e);
+                q_release_element(e);
+                cand_dup = true;
+            } else {
+                size += settle_cand(qf, cand, cand_dup, &result);
+                cand = e;
+                cand_dup = false;
+            }
+
+            if (list_empty(q)) {
+                heap[0] = heap[--n];
+                if (n > 0)
+                    qheap_sift_down(heap, n, 0);
+                break;
+            }
+            /* Duplicates come in clusters, so right after one, look for
+             * another first: a duplicate of @cand is not above @stop either.
+             * Otherwise the run more likely ends here.
+             */
+            const char *next = head_value(q);
+            same = cand_dup && !fast_strcmp(next, cand->value);
+            if (!same && stop && fast_strcmp(next, stop) > 0) {
+                heap[0] = heap[c];
+                heap[c] = q;
+                qheap_sift_down(heap, n, c);
+                break;
+            }
+            if (!cand_dup)
+                same = !fast_strcmp(next, cand->value);
         }
-        end = dest;
-        merge_p = head->next;
-        dest = head->next;
     }
-    q1 = list_entry(merge_p, queue_contex_t, chain);
-    return q1->size;
+    size += settle_cand(qf, cand, cand_dup, &result);
+    free(heap);
+
+    list_splice(&result, first->q);
+    qf->sorted = sorted;
+    index_fit(qf);
+    first->size = size;
+    return size;
 }
@@ -17,12 +17,14 @@
  * element_t - Linked list element
  * @value: pointer to array holding string
  * @list: node of a doubly-linked list
+ * @hash: node in the value index of its queue, see q_index()
  *
  * @value needs to be explicitly allocated and freed
  */
 typedef struct {
     char *value;
     struct list_head list;
+    struct list_head hash;
 } element_t;
 
 /**
@@ -35,7 +37,7 @@ typedef struct {
 typedef struct {
     struct list_head *q;
     struct list_head chain;
-    int size;
+    size_t size;
     int id;
 } queue_contex_t;
 
@@ -108,6 +110,68 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize);
  */
 element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
 
+/**
+ * q_index() - Turn the value index of queue on or off
+ * @head: header of queue
+ * @enable: true to build the index, false to drop it
+ *
+ * The index is a hash table chaining the elements through their @hash node,
+ * keyed by string. While it is on, q_contains(), q_count() and
+ * q_remove_value() take expected O(1) time instead of walking the queue, and
+ * every operation which adds or deletes elements keeps it up to date; the
+ * table grows as elements are inserted. Lookups never allocate. q_merge()
+ * moves the entries of the merged elements into the index of the first queue
+ * without allocating, so its table is only resized by the next insertion or
+ * by q_index(q, true); lookups before that stay correct but walk longer
+ * chains.
+ *
+ * Return: true for success, false if queue is NULL or allocation failed.
+ */
+bool q_index(struct list_head *head, bool enable);
+
+/**
+ * q_is_indexed() - Check whether queue has the value index on
+ * @head: header of queue
+ *
+ * Return: true if the index is on, false if not or queue is NULL.
+ */
+bool q_is_indexed(struct list_head *head);
+
+/**
+ * q_contains() - Check whether any element of queue holds a string
+ * @head: header of queue
+ * @s: string to look for
+ *
+ * Return: true if found, false if not or queue is NULL.
+ */
+bool q_contains(struct list_head *head, const char *s);
+
+/**
+ * q_count() - Count the elements of queue holding a string
+ * @head: header of queue
+ * @s: string to look for
+ *
+ * Return: the number of matching elements, 0 if queue is NULL.
+ */
+size_t q_count(struct list_head *head, const char *s);
+
+/**
+ * q_remove_value() - Remove an element holding a string from queue
+ * @head: header of queue
+ * @s: string to look for
+ * @sp: string would be inserted
+ * @bufsize: size of the string
+ *
+ * Like q_remove_head(), but unlinks some element whose value equals @s. When
+ * several do, which one is removed is unspecified.
+ *
+ * Return: the pointer to element, %NULL if queue is NULL or has no match.
+ */
+element_t *q_remove_value(struct list_head *head,
+                          const char *s,
+                          char *sp,
+                          size_t bufsize);
+
 /**
  * q_release_element() - Release the element
  * @e: element would be released
@@ -126,7 +190,7 @@ static inline void q_release_element(element_t *e)
  *
  * Return: the number of elements in queue, zero if queue is NULL or empty
  */
-int q_size(struct list_head *head);
+size_t q_size(struct list_head *head);
 
 /**
  * q_delete_mid() - Delete the middle node in queue
@@ -188,7 +252,7 @@ void q_reverse(struct list_head *head);
  * Reference:
  * https://leetcode.com/problems/reverse-nodes-in-k-group/
  */
-void q_reverseK(struct list_head *head, int k);
+void q_reverseK(struct list_head *head, size_t k);
 
 /**
  * q_sort() - Sort elements of queue in ascending order
@@ -199,6 +263,59 @@ void q_reverseK(struct list_head *head, int k);
  */
 void q_sort(struct list_head *head);
 
+/**
+ * q_is_sorted() - Check whether queue is known to be in ascending order
+ * @head: header of queue
+ *
+ * Every queue created by q_new() carries a flag telling that its elements are
+ * in ascending order. The queue operations keep it up to date in O(1) per
+ * call: inserting at either end compares only against the neighbouring end
+ * element, removals keep the flag, and q_swap(), q_reverse() and q_reverseK()
+ * clear it. q_sort() and q_merge() set it, and q_sort() returns immediately
+ * on a queue known to be sorted. A false result does not mean the queue is
+ * unsorted, only that it is not known to be sorted.
+ *
+ * Return: true if queue is known to be sorted, false if not or queue is NULL.
+ */
+bool q_is_sorted(struct list_head *head);
+
+/**
+ * q_set_sorted() - Record whether queue is in ascending order
+ * @head: header of queue
+ * @sorted: true if the elements are in ascending order
+ *
+ * Needed after reordering the elements of queue without the queue
+ * operations, e.g. when sorting it in another order. No effect if queue is
+ * NULL.
+ */
+void q_set_sorted(struct list_head *head, bool sorted);
+
+/**
+ * q_sort_k() - Move the k smallest elements to the front of queue, sorted
+ * @head: header of queue
+ * @k: number of smallest elements wanted
+ *
+ * Afterwards the first k elements are the k smallest ones in ascending order,
+ * and the remaining elements follow in unspecified order. A bounded max-heap
+ * of k node pointers makes this O(n log k) instead of the O(n log n) of a full
+ * sort. If k is not less than the size of queue, the whole queue is sorted.
+ *
+ * Return: true for success, false if queue is NULL or allocation failed.
+ */
+bool q_sort_k(struct list_head *head, size_t k);
+
+/**
+ * q_select() - Find the k-th smallest element of queue
+ * @head: header of queue
+ * @k: rank of the wanted element, 1 for the smallest
+ *
+ * The queue is left untouched. Takes O(n log k) time, like q_sort_k().
+ *
+ * Return: the element, %NULL if queue is NULL, k is out of range or
+ * allocation failed.
+ */
+element_t *q_select(struct list_head *head, size_t k);
+
 /**
  * q_descend() - Remove every node which has a node with a strictly greater
  * value anywhere to the right side of it.
@@ -212,7 +329,7 @@ void q_sort(struct list_head *head);
  *
  * Return: the number of elements in queue after performing operation
  */
-int q_descend(struct list_head *head);
+size_t q_descend(struct list_head *head);
 
 /**
  * q_merge() - Merge all the queues into one sorted queue, which is in ascending
@@ -226,11 +343,32 @@ int q_descend(struct list_head *head);
  * 'q' since they will be released externally. However, q_merge() is responsible
  * for making the queues to be NULL-queue, except the first one.
  *
+ * If the first queue has the value index on, the merged elements join it but
+ * its table is not resized here; call q_index(q, true) afterwards to resize
+ * it at once, otherwise the next insertion does.
+ *
  * Reference:
  * https://leetcode.com/problems/merge-k-sorted-lists/
  *
  * Return: the number of elements in queue after merging
  */
-int q_merge(struct list_head *head);
+size_t q_merge(struct list_head *head);
+
+/**
+ * q_merge_unique() - Merge all the queues into one sorted queue and delete
+ * all nodes that have duplicate string
+ * @head: header of chain
+ *
+ * Same result as q_merge() followed by q_delete_dup(), but done in a single
+ * k-way merge, which takes a run at a time from the queue with the smallest
+ * head: every node is visited once and duplicate runs are released as soon
+ * as they are found. Like q_merge(), the result ends up in the first
+ * queue of the chain and the other queues are left empty. A heap of one
+ * pointer per queue is allocated; if that fails, the function falls back to
+ * q_merge() and q_delete_dup().
+ *
+ * Return: the number of elements in queue after merging
+ */
+size_t q_merge_unique(struct list_head *head);
 
 #endif /* LAB0_QUEUE_H */
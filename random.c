@@ -28,6 +28,13 @@
 #define _GNU_SOURCE
 #endif
 
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "random.h"
 
 #if defined(__linux__) || defined(__GNU__)
@@ -293,3 +300,73 @@ int randombytes(uint8_t *buf, size_t n)
 #error "randombytes(...) is not supported on this platform"
 #endif
 }
+
+/* Userspace generator for test data: xoshiro256** by David Blackman and
+ * Sebastiano Vigna, see <https://prng.di.unimi.it/>.  Each thread seeds its
+ * own state with a single randombytes() call on first use.
+ */
+static __thread uint64_t prng_state[4];
+static __thread bool prng_seeded = false;
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+uint64_t prng_u64(void)
+{
+    uint64_t *s = prng_state;
+    if (!prng_seeded) {
+        if (randombytes((uint8_t *) s, sizeof(prng_state)) != 0 ||
+            !(s[0] | s[1] | s[2] | s[3])) {
+            /* Fall back to a fixed seed; the state must not be all zero */
+            for (int i = 0; i < 4; i++)
+                s[i] = random_shuffle(i + 1);
+        }
+        prng_seeded = true;
+    }
+
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+void prng_fill(uint8_t *buf, size_t len)
+{
+    for (; len >= sizeof(uint64_t); buf += 8, len -= 8) {
+        uint64_t r = prng_u64();
+        memcpy(buf, &r, sizeof(r));
+    }
+    if (len) {
+        uint64_t r = prng_u64();
+        memcpy(buf, &r, len);
+    }
+}
+
+/* Byte b maps to letter (b * 26) >> 8, which is within one count of uniform */
+void prng_letters(char *buf, size_t len)
+{
+    prng_fill((uint8_t *) buf, len);
+    size_t n = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i n_letters = _mm_set1_epi16(26);
+    const __m128i a = _mm_set1_epi8('a');
+    for (; n + 16 <= len; n += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (buf + n));
+        /* Widen each byte b to b << 8, so that mulhi yields (b * 26) >> 8 */
+        __m128i lo = _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, v), n_letters);
+        __m128i hi = _mm_mulhi_epu16(_mm_unpackhi_epi8(zero, v), n_letters);
+        v = _mm_add_epi8(_mm_packus_epi16(lo, hi), a);
+        _mm_storeu_si128((__m128i *) (buf + n), v);
+    }
+#endif
+    for (; n < len; n++)
+        buf[n] = 'a' + (((uint8_t) buf[n] * 26) >> 8);
+}
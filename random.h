@@ -6,6 +6,17 @@
 
 extern int randombytes(uint8_t *buf, size_t len);
 
+/* Fast generator for test data, not suitable for cryptography.  Only the
+ * seed of each thread comes from randombytes().
+ */
+uint64_t prng_u64(void);
+
+/* Fill @buf with @len random bytes from prng_u64() */
+void prng_fill(uint8_t *buf, size_t len);
+
+/* Fill @buf with @len random lowercase letters, not NUL-terminated */
+void prng_letters(char *buf, size_t len);
+
 static inline uint8_t randombit(void)
 {
     uint8_t ret = 0;
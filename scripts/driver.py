@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 
 from __future__ import print_function
+import re
 import subprocess
 import sys
 import getopt
@@ -17,6 +18,7 @@ class Tracer:
     autograde = False
     useValgrind = False
     colored = False
+    jobs = 1
 
     traceDict = {
         1: "trace-01-ops",
@@ -69,13 +71,15 @@ class Tracer:
                  verbLevel=0,
                  autograde=False,
                  useValgrind=False,
-                 colored=False):
+                 colored=False,
+                 jobs=1):
         if qtest != "":
             self.qtest = qtest
         self.verbLevel = verbLevel
         self.autograde = autograde
         self.useValgrind = useValgrind
         self.colored = colored
+        self.jobs = jobs
 
     def printInColor(self, text, color):
         if self.colored == False:
@@ -97,6 +101,36 @@ class Tracer:
             return False
         return retcode == 0
 
+    # Run the traces in one qtest, which forks a process per trace, and
+    # return whether each passed.  qtest prints a '---' line per trace after
+    # its output, which is replaced by the line showing the points.
+    def runTracesParallel(self, tidList, report):
+        vname = "%d" % self.verbLevel
+        clist = self.command + ["-v", vname, "-j", "%d" % self.jobs]
+        for t in tidList:
+            clist += ["-f", "%s/%s.cmd" % (self.traceDirectory,
+                                           self.traceDict[t])]
+        byName = {self.traceDict[t]: t for t in tidList}
+        result = re.compile(r'^---\t(\S+)\t(\d+)/1\t')
+        passed = {}
+        try:
+            proc = subprocess.Popen(clist, stdout=subprocess.PIPE,
+                                    universal_newlines=True)
+        except Exception as e:
+            self.printInColor("Call of '%s' failed: %s" % (" ".join(clist), e), self.RED)
+            return passed
+        for line in proc.stdout:
+            m = result.match(line)
+            if m and m.group(1) in byName:
+                t = byName[m.group(1)]
+                passed[t] = m.group(2) == "1"
+                report(t, passed[t])
+            elif not line.startswith("---\tTOTAL") and \
+                    not line.startswith("+++ TESTING"):
+                print(line, end='')
+        proc.wait()
+        return passed
+
     def run(self, tid=0):
         scoreDict = {k: 0 for k in self.traceDict.keys()}
         print("---\tTrace\t\tPoints")
@@ -110,14 +144,14 @@ class Tracer:
         score = 0
         maxscore = 0
         if self.useValgrind:
-            self.command = ['valgrind', self.qtest]
+            # Valgrind slows qtest down far past the time limits
+            self.command = ['valgrind', self.qtest, '-n']
         else:
             self.command = [self.qtest]
-        for t in tidList:
+
+        def report(t, ok):
+            nonlocal score, maxscore
             tname = self.traceDict[t]
-            if self.verbLevel > 0:
-                print("+++ TESTING trace %s:" % tname)
-            ok = self.runTrace(t)
             maxval = self.maxScores[t]
             tval = maxval if ok else 0
             if tval < maxval:
@@ -127,6 +161,18 @@ class Tracer:
             score += tval
             maxscore += maxval
             scoreDict[t] = tval
+
+        if self.jobs > 1 and not self.useValgrind:
+            passed = self.runTracesParallel(tidList, report)
+            # Traces whose result never came, such as after a crash of qtest
+            for t in tidList:
+                if t not in passed:
+                    report(t, False)
+        else:
+            for t in tidList:
+                if self.verbLevel > 0:
+                    print("+++ TESTING trace %s:" % self.traceDict[t])
+                report(t, self.runTrace(t))
         if score < maxscore:
             self.printInColor("---\tTOTAL\t\t%d/%d" % (score, maxscore), self.RED)
         else:
@@ -146,12 +192,13 @@ class Tracer:
             sys.exit(1)
 
 def usage(name):
-    print("Usage: %s [-h] [-p PROG] [-t TID] [-v VLEVEL] [--valgrind] [-c]" % name)
+    print("Usage: %s [-h] [-p PROG] [-t TID] [-v VLEVEL] [--valgrind] [-c] [-j JOBS]" % name)
     print("  -h        Print this message")
     print("  -p PROG   Program to test")
     print("  -t TID    Trace ID to test")
     print("  -v VLEVEL Set verbosity level (0-3)")
     print("  -c Enable colored text")
+    print("  -j JOBS   Run up to JOBS traces at a time")
     sys.exit(0)
 
 
@@ -163,8 +210,9 @@ def run(name, args):
     autograde = False
     useValgrind = False
     colored = False
+    jobs = 1
 
-    optlist, args = getopt.getopt(args, 'hp:t:v:A:c', ['valgrind'])
+    optlist, args = getopt.getopt(args, 'hp:t:v:A:cj:', ['valgrind'])
     for (opt, val) in optlist:
         if opt == '-h':
             usage(name)
@@ -181,6 +229,8 @@ def run(name, args):
             useValgrind = True
         elif opt == '-c':
             colored = True
+        elif opt == '-j':
+            jobs = int(val)
         else:
             print("Unrecognized option '%s'" % opt)
             usage(name)
@@ -190,7 +240,8 @@ def run(name, args):
                verbLevel=vlevel,
                autograde=autograde,
                useValgrind=useValgrind,
-               colored=colored)
+               colored=colored,
+               jobs=jobs)
     t.run(tid)
 
 
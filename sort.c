@@ -0,0 +1,520 @@
+/* Compile-time specialized list sorts */
+
+#include <ctype.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "fastcmp.h"
+#include "queue.h"
+#include "sort.h"
+
+uint64_t sort_cmp_count = 0;
+
+/* Indirect comparison: @priv points to the caller's function and data */
+typedef struct {
+    list_cmp_func_t cmp;
+    void *priv;
+} cmp_thunk_t;
+
+static inline __attribute__((always_inline)) int cmp_thunk(
+    void *priv,
+    const struct list_head *a,
+    const struct list_head *b)
+{
+    const cmp_thunk_t *thunk = priv;
+    return thunk->cmp(thunk->priv, a, b);
+}
+
+DEFINE_LIST_SORT(list_sort_thunk, cmp_thunk)
+
+/**
+ * list_sort() - Sort a list
+ * @priv: private data, opaque to list_sort(), passed to @cmp
+ * @head: the list to sort
+ * @cmp: the elements comparison function
+ *
+ * The comparison function @cmp must return > 0 if @a should sort after
+ * @b ("@a > @b" if you want an ascending sort), and <= 0 if @a should
+ * sort before @b *or* their original order should be preserved.  It is
+ * always called with the element that came first in the input in @a,
+ * and list_sort is a stable sort, so it is not necessary to distinguish
+ * the @a < @b and @a == @b cases.
+ *
+ * This is compatible with two styles of @cmp function:
+ * - The traditional style which returns <0 / =0 / >0, or
+ * - Returning a boolean 0/1.
+ * The latter offers a chance to save a few cycles in the comparison
+ * (which is used by e.g. plug_ctx_cmp() in block/blk-mq.c).
+ *
+ * A good way to write a multi-word comparison is::
+ *
+ *	if (a->high != b->high)
+ *		return a->high > b->high;
+ *	if (a->middle != b->middle)
+ *		return a->middle > b->middle;
+ *	return a->low > b->low;
+ *
+ *
+ * This mergesort is as eager as possible while always performing at least
+ * 2:1 balanced merges.  Given two pending sublists of size 2^k, they are
+ * merged to a size-2^(k+1) list as soon as we have 2^k following elements.
+ *
+ * Thus, it will avoid cache thrashing as long as 3*2^k elements can
+ * fit into the cache.  Not quite as good as a fully-eager bottom-up
+ * mergesort, but it does use 0.2*n fewer comparisons, so is faster in
+ * the common case that everything fits into L1.
+ *
+ *
+ * The merging is controlled by "count", the number of elements in the
+ * pending lists.  This is beautifully simple code, but rather subtle.
+ *
+ * Each time we increment "count", we set one bit (bit k) and clear
+ * bits k-1 .. 0.  Each time this happens (except the very first time
+ * for each bit, when count increments to 2^k), we merge two lists of
+ * size 2^k into one list of size 2^(k+1).
+ *
+ * This merge happens exactly when the count reaches an odd multiple of
+ * 2^k, which is when we have 2^k elements pending in smaller lists,
+ * so it's safe to merge away two lists of size 2^k.
+ *
+ * After this happens twice, we have created two lists of size 2^(k+1),
+ * which will be merged into a list of size 2^(k+2) before we create
+ * a third list of size 2^(k+1), so there are never more than two pending.
+ *
+ * The number of pending lists of size 2^k is determined by the
+ * state of bit k of "count" plus two extra pieces of information:
+ *
+ * - The state of bit k-1 (when k == 0, consider bit -1 always set), and
+ * - Whether the higher-order bits are zero or non-zero (i.e.
+ *   is count >= 2^(k+1)).
+ *
+ * There are six states we distinguish.  "x" represents some arbitrary
+ * bits, and "y" represents some arbitrary non-zero bits:
+ * 0:  00x: 0 pending of size 2^k;           x pending of sizes < 2^k
+ * 1:  01x: 0 pending of size 2^k; 2^(k-1) + x pending of sizes < 2^k
+ * 2: x10x: 0 pending of size 2^k; 2^k     + x pending of sizes < 2^k
+ * 3: x11x: 1 pending of size 2^k; 2^(k-1) + x pending of sizes < 2^k
+ * 4: y00x: 1 pending of size 2^k; 2^k     + x pending of sizes < 2^k
+ * 5: y01x: 2 pending of size 2^k; 2^(k-1) + x pending of sizes < 2^k
+ * (merge and loop back to state 2)
+ *
+ * We gain lists of size 2^k in the 2->3 and 4->5 transitions (because
+ * bit k-1 is set while the more significant bits are non-zero) and
+ * merge them away in the 5->2 transition.  Note in particular that just
+ * before the 5->2 transition, all lower-order bits are 11 (state 3),
+ * so there is one list of each smaller size.
+ *
+ * When we reach the end of the input, we merge all the pending
+ * lists, from smallest to largest.  If you work through cases 2 to
+ * 5 above, you can see that the number of elements we merge with a list
+ * of size 2^k varies from 2^(k-1) (cases 3 and 5 when x == 0) to
+ * 2^(k+1) - 1 (second merge of case 5 when x == 2^(k-1) - 1).
+ */
+__attribute__((nonnull(2, 3))) void list_sort(void *priv,
+                                              struct list_head *head,
+                                              list_cmp_func_t cmp)
+{
+    cmp_thunk_t thunk = {.cmp = cmp, .priv = priv};
+    list_sort_thunk(&thunk, head);
+}
+
+const char *const sort_order_names[N_SORT_ORDER + 1] = {
+    [SORT_ASCEND] = "ascend",
+    [SORT_DESCEND] = "descend",
+    [SORT_LENGTH] = "length",
+    [SORT_NATURAL] = "natural",
+    [N_SORT_ORDER] = NULL,
+};
+
+/* Shorter strings first, equal lengths in ascending order */
+static inline int length_strcmp(const char *a, const char *b)
+{
+    size_t la = strlen(a), lb = strlen(b);
+    if (la != lb)
+        return la < lb ? -1 : 1;
+    return fast_strcmp(a, b);
+}
+
+/* Like strcmp, but maximal runs of digits compare by their numeric value,
+ * so "item9" sorts before "item10".
+ */
+static int natural_strcmp(const char *a, const char *b)
+{
+    for (;;) {
+        if (isdigit((unsigned char) *a) && isdigit((unsigned char) *b)) {
+            /* Without leading zeros, a longer run holds the larger number
+             * and runs of equal length compare like strings.
+             */
+            while (*a == '0')
+                a++;
+            while (*b == '0')
+                b++;
+            const char *end_a = a, *end_b = b;
+            while (isdigit((unsigned char) *end_a))
+                end_a++;
+            while (isdigit((unsigned char) *end_b))
+                end_b++;
+            ptrdiff_t len_a = end_a - a, len_b = end_b - b;
+            if (len_a != len_b)
+                return len_a < len_b ? -1 : 1;
+            int res = memcmp(a, b, len_a);
+            if (res)
+                return res;
+            a = end_a;
+            b = end_b;
+            continue;
+        }
+
+        unsigned char ca = *a, cb = *b;
+        if (ca != cb || !ca)
+            return ca - cb;
+        a++;
+        b++;
+    }
+}
+
+int sort_order_cmp(sort_order_t order, const char *a, const char *b)
+{
+    switch (order) {
+    case SORT_DESCEND:
+        return fast_strcmp(b, a);
+    case SORT_LENGTH:
+        return length_strcmp(a, b);
+    case SORT_NATURAL:
+        return natural_strcmp(a, b);
+    default:
+        return fast_strcmp(a, b);
+    }
+}
+
+#define VALUE_OF(node) (list_entry(node, element_t, list)->value)
+
+/* Generate list comparison function 'cmp_<order>' from string comparison */
+#define DEFINE_ELEMENT_CMP(order, str_cmp)                                 \
+    static inline __attribute__((always_inline)) int cmp_##order(          \
+        void *priv, const struct list_head *a, const struct list_head *b) \
+    {                                                                      \
+        return str_cmp(VALUE_OF(a), VALUE_OF(b));                          \
+    }
+
+static inline int descend_strcmp(const char *a, const char *b)
+{
+    return fast_strcmp(b, a);
+}
+
+DEFINE_ELEMENT_CMP(ascend, fast_strcmp)
+DEFINE_ELEMENT_CMP(descend, descend_strcmp)
+DEFINE_ELEMENT_CMP(length, length_strcmp)
+DEFINE_ELEMENT_CMP(natural, natural_strcmp)
+
+DEFINE_LIST_SORT(sort_ascend, cmp_ascend)
+DEFINE_LIST_SORT(sort_descend, cmp_descend)
+DEFINE_LIST_SORT(sort_length, cmp_length)
+DEFINE_LIST_SORT(sort_natural, cmp_natural)
+
+/* The counting variants of the engines, which only sortbench runs, compare
+ * through these, so that q_sort() pays nothing for sort_cmp_count.  A
+ * constant @counted folds away once inlined.
+ */
+static inline __attribute__((always_inline)) int cmp_ascend_by(
+    const struct list_head *a,
+    const struct list_head *b,
+    bool counted)
+{
+    if (counted)
+        sort_cmp_count++;
+    return cmp_ascend(NULL, a, b);
+}
+
+static inline __attribute__((always_inline)) int cmp_ascend_counted(
+    void *priv,
+    const struct list_head *a,
+    const struct list_head *b)
+{
+    return cmp_ascend_by(a, b, true);
+}
+
+DEFINE_LIST_SORT(sort_ascend_counted, cmp_ascend_counted)
+
+void sort_by_order(struct list_head *head, sort_order_t order)
+{
+    switch (order) {
+    case SORT_DESCEND:
+        sort_descend(NULL, head);
+        break;
+    case SORT_LENGTH:
+        sort_length(NULL, head);
+        break;
+    case SORT_NATURAL:
+        sort_natural(NULL, head);
+        break;
+    default:
+        sort_ascend(NULL, head);
+        break;
+    }
+}
+
+void sort_by_order_indirect(struct list_head *head, sort_order_t order)
+{
+    static const list_cmp_func_t cmp_funcs[N_SORT_ORDER] = {
+        [SORT_ASCEND] = cmp_ascend,
+        [SORT_DESCEND] = cmp_descend,
+        [SORT_LENGTH] = cmp_length,
+        [SORT_NATURAL] = cmp_natural,
+    };
+    if (order >= N_SORT_ORDER)
+        order = SORT_ASCEND;
+    list_sort(NULL, head, cmp_funcs[order]);
+}
+
+/* get the cut point in @head until which the value is smaller than @s */
+static inline __attribute__((always_inline)) struct list_head *
+get_cut(struct list_head *head, char *s, bool counted)
+{
+    element_t *entry = NULL, *safe = NULL;
+    list_for_each_entry_safe (entry, safe, head, list) {
+        if (counted)
+            sort_cmp_count++;
+        if (fast_strcmp(entry->value, s) > 0)
+            break;
+    }
+    entry = list_entry(entry->list.prev, element_t, list);
+    return &entry->list;
+}
+
+static inline __attribute__((always_inline)) void merge_runs(
+    struct list_head *l1,
+    struct list_head *l2,
+    struct list_head *dest,
+    bool counted)
+{
+    if (!l2 || list_empty(l2)) {
+        list_splice_init(l1, dest);
+        return;
+    }
+    LIST_HEAD(tmp);
+    struct list_head *lists[2] = {l1, l2};
+    struct list_head *cut = NULL;
+    int flag = 0;
+    while (!list_empty(l1) && !list_empty(l2)) {
+        cut = get_cut(lists[flag],
+                      list_first_entry(lists[!flag], element_t, list)->value,
+                      counted);
+        list_cut_position(&tmp, lists[flag], cut);
+        list_splice_tail_init(&tmp, dest);
+        flag = !flag;
+    }
+    for (int i = 0; i < 2; i++) {
+        list_splice_tail_init(lists[i], dest);
+    }
+}
+
+/* Merge two sorted lists into @dest, a run at a time */
+void merge_two_list(struct list_head *l1,
+                    struct list_head *l2,
+                    struct list_head *dest)
+{
+    merge_runs(l1, l2, dest, false);
+}
+
+/* Split @head at the midpoint found by walking inwards from both ends */
+static inline void split_halves(struct list_head *head,
+                                struct list_head *h1,
+                                struct list_head *h2)
+{
+    struct list_head *fw = head->next, *bw = head->prev;
+    while (fw != bw && fw->next != bw) {
+        fw = fw->next;
+        bw = bw->prev;
+    }
+    list_cut_position(h2, head, fw);
+    list_splice_init(head, h1);
+}
+
+/* Recursive top-down mergesort, splitting at the midpoint */
+static void sort_topdown(struct list_head *head)
+{
+    if (list_empty(head) || list_is_singular(head))
+        return;
+
+    LIST_HEAD(h1);
+    LIST_HEAD(h2);
+    split_halves(head, &h1, &h2);
+    sort_topdown(&h1);
+    sort_topdown(&h2);
+    merge_runs(&h1, &h2, head, false);
+}
+
+static void sort_topdown_counted(struct list_head *head)
+{
+    if (list_empty(head) || list_is_singular(head))
+        return;
+
+    LIST_HEAD(h1);
+    LIST_HEAD(h2);
+    split_halves(head, &h1, &h2);
+    sort_topdown_counted(&h1);
+    sort_topdown_counted(&h2);
+    merge_runs(&h1, &h2, head, true);
+}
+
+/* Upper bound of pending runs: slot i holds a merge of 2^i runs */
+#define MAX_PENDING (8 * sizeof(size_t))
+
+/* Detach the maximal run at the front of null-terminated @list and store
+ * what follows it in @rest.  A strictly descending run is reversed while
+ * walking it, which keeps the sort stable.
+ */
+static inline __attribute__((always_inline)) struct list_head *
+take_run(struct list_head *list, struct list_head **rest, bool counted)
+{
+    struct list_head *cur = list->next;
+    if (!cur || cmp_ascend_by(list, cur, counted) <= 0) {
+        struct list_head *tail = list;
+        while (tail->next && cmp_ascend_by(tail, tail->next, counted) <= 0)
+            tail = tail->next;
+        *rest = tail->next;
+        tail->next = NULL;
+        return list;
+    }
+
+    struct list_head *run = list;
+    list->next = NULL;
+    while (cur) {
+        struct list_head *next = cur->next;
+        cur->next = run;
+        run = cur;
+        if (!next || cmp_ascend_by(cur, next, counted) <= 0) {
+            cur = next;
+            break;
+        }
+        cur = next;
+    }
+    *rest = cur;
+    return run;
+}
+
+static inline __attribute__((always_inline)) struct list_head *
+merge_by(struct list_head *a, struct list_head *b, bool counted)
+{
+    return counted ? sort_ascend_counted_merge(NULL, a, b)
+                   : sort_ascend_merge(NULL, a, b);
+}
+
+static inline __attribute__((always_inline)) void merge_final_by(
+    struct list_head *head,
+    struct list_head *a,
+    struct list_head *b,
+    bool counted)
+{
+    if (counted)
+        sort_ascend_counted_merge_final(NULL, head, a, b);
+    else
+        sort_ascend_merge_final(NULL, head, a, b);
+}
+
+/* Iterative bottom-up mergesort.  One pass over the input cuts it into
+ * natural runs, which are added to an array of pending lists the way a
+ * binary counter is incremented: slot i is either empty or holds the merge
+ * of 2^i runs.  Neither recursion nor midpoint walks are needed, and the
+ * only extra space is the array of MAX_PENDING pointers.
+ */
+static inline __attribute__((always_inline)) void bottomup(
+    struct list_head *head,
+    bool counted)
+{
+    if (list_empty(head) || list_is_singular(head))
+        return;
+
+    struct list_head *pending[MAX_PENDING] = {NULL};
+    struct list_head *list = head->next;
+    size_t top = 0; /* Slots at and above top are empty */
+
+    /* Convert to a null-terminated singly-linked list. */
+    head->prev->next = NULL;
+
+    while (list) {
+        struct list_head *run = take_run(list, &list, counted);
+        size_t i;
+        /* Pending lists hold earlier elements, so they go first */
+        for (i = 0; i < MAX_PENDING - 1 && pending[i]; i++) {
+            run = merge_by(pending[i], run, counted);
+            pending[i] = NULL;
+        }
+        pending[i] = run;
+        if (i >= top)
+            top = i + 1;
+    }
+
+    /* Merge remaining lists from the newest to the oldest, rebuilding the
+     * prev links in the final merge.
+     */
+    list = NULL;
+    for (size_t i = 0; i < top; i++) {
+        if (!pending[i])
+            continue;
+        if (!list) {
+            list = pending[i];
+        } else if (i == top - 1) {
+            merge_final_by(head, pending[i], list, counted);
+            return;
+        } else {
+            list = merge_by(pending[i], list, counted);
+        }
+    }
+
+    /* A single pending list is left, as after a power of 2 runs, so there
+     * was no final merge to rebuild the prev links: do it here.
+     */
+    struct list_head *prev = head;
+    for (struct list_head *node = list; node; node = node->next) {
+        prev->next = node;
+        node->prev = prev;
+        prev = node;
+    }
+    prev->next = head;
+    head->prev = prev;
+}
+
+static void sort_bottomup(struct list_head *head)
+{
+    bottomup(head, false);
+}
+
+static void sort_bottomup_counted(struct list_head *head)
+{
+    bottomup(head, true);
+}
+
+static void sort_linux(struct list_head *head)
+{
+    sort_ascend(NULL, head);
+}
+
+static void sort_linux_counted(struct list_head *head)
+{
+    sort_ascend_counted(NULL, head);
+}
+
+const sort_engine_t sort_engines[N_SORT_ENGINE] = {
+    [SORT_ENGINE_BOTTOMUP] = {"bottomup", sort_bottomup, sort_bottomup_counted,
+                              "Iterative mergesort over natural runs"},
+    [SORT_ENGINE_TOPDOWN] = {"topdown", sort_topdown, sort_topdown_counted,
+                             "Recursive mergesort splitting at the midpoint"},
+    [SORT_ENGINE_LINUX] = {"linux", sort_linux, sort_linux_counted,
+                           "Bottom-up list_sort from the Linux kernel"},
+};
+
+const char *const sort_engine_names[N_SORT_ENGINE + 1] = {
+    [SORT_ENGINE_BOTTOMUP] = "bottomup",
+    [SORT_ENGINE_TOPDOWN] = "topdown",
+    [SORT_ENGINE_LINUX] = "linux",
+    [N_SORT_ENGINE] = NULL,
+};
+
+/* define `USE_LINUX_SORT` at compile time to make list_sort the default */
+#ifdef USE_LINUX_SORT
+int sort_engine = SORT_ENGINE_LINUX;
+#else
+int sort_engine = SORT_ENGINE_BOTTOMUP;
+#endif
@@ -0,0 +1,237 @@
+#ifndef LAB0_SORT_H
+#define LAB0_SORT_H
+
+/* Stable merge sorts over circular doubly-linked lists, specialized at
+ * compile time for each comparison function.
+ */
+
+#include <stdint.h>
+
+#include "list.h"
+
+typedef int
+    __attribute__((nonnull(2, 3))) (*list_cmp_func_t)(void *,
+                                                      const struct list_head *,
+                                                      const struct list_head *);
+
+/**
+ * DEFINE_LIST_SORT() - Instantiate list_sort for a fixed comparison function
+ * @name: name of the generated sort function
+ * @cmp: comparison function, with the signature of list_cmp_func_t
+ *
+ * Expands to 'static void name(void *priv, struct list_head *head)'.  Since
+ * @cmp is named rather than passed by pointer, it is inlined into the merge
+ * loops together with the merge helpers; give it internal linkage so the
+ * compiler is free to do so.
+ *
+ * The algorithm is list_sort() from the Linux kernel: a bottom-up mergesort
+ * which is as eager as possible while always performing at least 2:1
+ * balanced merges.  See list_sort() in sort.c for the full description of
+ * the pending-list invariants.
+ */
+#define DEFINE_LIST_SORT(name, cmp)                                          \
+    /*                                                                       \
+     * Returns a list organized in an intermediate format suited to          \
+     * chaining of merge() calls: null-terminated, no reserved or sentinel   \
+     * head node, "prev" links not maintained.                               \
+     */                                                                      \
+    static inline __attribute__((always_inline)) struct list_head            \
+        *name##_merge(void *priv, struct list_head *a, struct list_head *b)  \
+    {                                                                        \
+        struct list_head *head = NULL, **tail = &head;                       \
+                                                                             \
+        for (;;) {                                                           \
+            /* if equal, take 'a' -- important for sort stability */         \
+            if (cmp(priv, a, b) <= 0) {                                      \
+                *tail = a;                                                   \
+                tail = &a->next;                                             \
+                a = a->next;                                                 \
+                if (!a) {                                                    \
+                    *tail = b;                                               \
+                    break;                                                   \
+                }                                                            \
+            } else {                                                         \
+                *tail = b;                                                   \
+                tail = &b->next;                                             \
+                b = b->next;                                                 \
+                if (!b) {                                                    \
+                    *tail = a;                                               \
+                    break;                                                   \
+                }                                                            \
+            }                                                                \
+        }                                                                    \
+        return head;                                                         \
+    }                                                                        \
+                                                                             \
+    /*                                                                       \
+     * Combine final list merge with restoration of standard doubly-linked   \
+     * list structure.                                                       \
+     */                                                                      \
+    static inline __attribute__((always_inline)) void name##_merge_final(    \
+        void *priv, struct list_head *head, struct list_head *a,             \
+        struct list_head *b)                                                 \
+    {                                                                        \
+        struct list_head *tail = head;                                       \
+                                                                             \
+        for (;;) {                                                           \
+            /* if equal, take 'a' -- important for sort stability */         \
+            if (cmp(priv, a, b) <= 0) {                                      \
+                tail->next = a;                                              \
+                a->prev = tail;                                              \
+                tail = a;                                                    \
+                a = a->next;                                                 \
+                if (!a)                                                      \
+                    break;                                                   \
+            } else {                                                         \
+                tail->next = b;                                              \
+                b->prev = tail;                                              \
+                tail = b;                                                    \
+                b = b->next;                                                 \
+                if (!b) {                                                    \
+                    b = a;                                                   \
+                    break;                                                   \
+                }                                                            \
+            }                                                                \
+        }                                                                    \
+                                                                             \
+        /* Finish linking remainder of list b on to tail */                  \
+        tail->next = b;                                                      \
+        do {                                                                 \
+            b->prev = tail;                                                  \
+            tail = b;                                                        \
+            b = b->next;                                                     \
+        } while (b);                                                         \
+                                                                             \
+        /* And the final links to make a circular doubly-linked list */      \
+        tail->next = head;                                                   \
+        head->prev = tail;                                                   \
+    }                                                                        \
+                                                                             \
+    static void name(void *priv, struct list_head *head)                     \
+    {                                                                        \
+        struct list_head *list = head->next, *pending = NULL;                \
+        size_t count = 0; /* Count of pending */                             \
+                                                                             \
+        if (list == head->prev) /* Zero or one elements */                   \
+            return;                                                          \
+                                                                             \
+        /* Convert to a null-terminated singly-linked list. */               \
+        head->prev->next = NULL;                                             \
+                                                                             \
+        do {                                                                 \
+            size_t bits;                                                     \
+            struct list_head **tail = &pending;                              \
+                                                                             \
+            /* Find the least-significant clear bit in count */              \
+            for (bits = count; bits & 1; bits >>= 1)                         \
+                tail = &(*tail)->prev;                                       \
+            /* Do the indicated merge */                                     \
+            if (bits) {                                                      \
+                struct list_head *a = *tail, *b = a->prev;                   \
+                                                                             \
+                a = name##_merge(priv, b, a);                                \
+                /* Install the merged result in place of the inputs */       \
+                a->prev = b->prev;                                           \
+                *tail = a;                                                   \
+            }                                                                \
+                                                                             \
+            /* Move one element from input list to pending */                \
+            list->prev = pending;                                            \
+            pending = list;                                                  \
+            list = list->next;                                               \
+            pending->next = NULL;                                            \
+            count++;                                                         \
+        } while (list);                                                      \
+                                                                             \
+        /* End of input; merge together all the pending lists. */            \
+        list = pending;                                                      \
+        pending = pending->prev;                                             \
+        for (;;) {                                                           \
+            struct list_head *next = pending->prev;                          \
+                                                                             \
+            if (!next)                                                       \
+                break;                                                       \
+            list = name##_merge(priv, pending, list);                        \
+            pending = next;                                                  \
+        }                                                                    \
+        /* The final merge, rebuilding prev links */                         \
+        name##_merge_final(priv, head, pending, list);                       \
+    }
+
+/**
+ * list_sort() - Sort a list through a comparison function pointer
+ * @priv: private data, opaque to list_sort(), passed to @cmp
+ * @head: the list to sort
+ * @cmp: the elements comparison function
+ *
+ * Generic counterpart of the DEFINE_LIST_SORT() instantiations, paying one
+ * indirect call per comparison.
+ */
+__attribute__((nonnull(2, 3))) void list_sort(void *priv,
+                                              struct list_head *head,
+                                              list_cmp_func_t cmp);
+
+/* Orders in which qtest is able to sort a queue of element_t */
+typedef enum {
+    SORT_ASCEND,
+    SORT_DESCEND,
+    SORT_LENGTH,  /* Shorter strings first, ties in ascending order */
+    SORT_NATURAL, /* Ascending, but runs of digits compare numerically */
+    N_SORT_ORDER,
+} sort_order_t;
+
+/* Names of sort_order_t values, terminated by NULL */
+extern const char *const sort_order_names[N_SORT_ORDER + 1];
+
+/* Compare two strings in @order, with the sign convention of strcmp */
+int sort_order_cmp(sort_order_t order, const char *a, const char *b);
+
+/* Sort queue of element_t in @order with the specialized instantiation */
+void sort_by_order(struct list_head *head, sort_order_t order);
+
+/* Sort queue of element_t in @order with list_sort() and a function pointer */
+void sort_by_order_indirect(struct list_head *head, sort_order_t order);
+
+/* Number of element comparisons made by the counted variants of the sort
+ * engines.  Callers reset it before the sort they want to measure.
+ */
+extern uint64_t sort_cmp_count;
+
+/**
+ * merge_two_list() - Merge two sorted queues of element_t
+ * @l1: first queue, ascending
+ * @l2: second queue, ascending, may be NULL
+ * @dest: queue receiving the result at its tail
+ *
+ * Whole runs of one queue that precede the head of the other are moved with
+ * a single splice.  @l1 and @l2 are left empty.
+ */
+void merge_two_list(struct list_head *l1,
+                    struct list_head *l2,
+                    struct list_head *dest);
+
+/* Algorithms which q_sort() can dispatch to, sorting in ascending order */
+typedef struct {
+    const char *name;
+    void (*sort)(struct list_head *head);
+    void (*counted)(struct list_head *head); /* Also adds to sort_cmp_count */
+    const char *summary;
+} sort_engine_t;
+
+typedef enum {
+    SORT_ENGINE_BOTTOMUP,
+    SORT_ENGINE_TOPDOWN,
+    SORT_ENGINE_LINUX,
+    N_SORT_ENGINE,
+} sort_engine_id_t;
+
+/* Registered engines; add new ones to both tables in sort.c */
+extern const sort_engine_t sort_engines[N_SORT_ENGINE];
+
+/* Names of sort_engine_id_t values, terminated by NULL */
+extern const char *const sort_engine_names[N_SORT_ENGINE + 1];
+
+/* Engine used by q_sort(), one of sort_engine_id_t */
+extern int sort_engine;
+
+#endif /* LAB0_SORT_H */
@@ -0,0 +1,21 @@
+# Run several experiments on one large queue built only once: each restore
+# starts over from a copy-on-write image of the queue taken at checkpoint,
+# which takes far less time than building it again.
+option fail 0
+option malloc 0
+option limitins 100000
+option limitsort 100000
+option limit 100000
+new
+time ih RAND 2000000
+checkpoint
+option sort bottomup
+time sort
+time restore
+option sort linux
+time sort
+time restore
+option sort topdown
+time sort
+time restore
+time dedup
@@ -0,0 +1,31 @@
+# Benchmark sort, dedup and merge on inputs other than uniform random strings:
+# skewed (Zipf), already ordered, reverse ordered and duplicate-heavy values.
+option fail 0
+option malloc 0
+option limitsort 10000
+option limit 10000
+new
+it zipf:1.1,100000 300000
+time sort
+time dedup
+free
+new
+it seq:key 300000
+time sort
+free
+new
+it rev:key 300000
+time sort
+free
+new
+it dup:0.9 300000
+time sort
+time dedup
+free
+new
+it len:1-64 300000
+time sort
+new
+it seq:key 300000
+time merge
+free
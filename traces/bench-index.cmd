@@ -0,0 +1,19 @@
+# Benchmark lookups by value in a queue of 1000000 strings
+# With the index on, find touches only one hash bucket; once it is turned
+# off the same command walks the whole queue.
+option fail 0
+option malloc 0
+option index 1
+new
+ih RAND 500000
+it needle
+ih RAND 500000
+time find needle
+time find haystack
+rmval needle
+it needle
+option index 0
+time find needle
+time find haystack
+rmval needle
+free
@@ -0,0 +1,27 @@
+# Queues of more than 2^31 elements, whose sizes and counts overflow an int.
+# slotcheck first checks the harness bookkeeping at that scale without the
+# memory.  In compact mode an element and its string take 64 bytes instead of
+# about 170 with the harness headers, so the rest needs a machine with some
+# 150 GB of memory.
+#
+# UNVERIFIED: nothing after slotcheck has been run at this size, nor is it in
+# CI.  check-large.cmd runs the same steps at 2^20 elements from 'make check'.
+slotcheck
+option fail 0
+option malloc 0
+option poison off
+option compact 1
+option verify off
+option limit 86400000
+option limitins 86400000
+option limitrm 86400000
+new
+time it seq: 2147483700
+it zzz 10
+time size
+find zzz 10
+rh 0000000000
+rt zzz
+size
+time descend
+size
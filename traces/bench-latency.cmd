@@ -0,0 +1,16 @@
+# Throughput and latency percentiles of single queue operations; the tail
+# percentiles expose operations that are occasionally slow, such as those
+# hitting a slow path of the allocator.
+option fail 0
+option malloc 0
+option cache 1
+new
+ih RAND 10000
+bench -n 100000 -w 1000 it RAND
+bench -n 100000 -w 1000 ih RAND
+bench -n 100000 -w 1000 rh
+bench -n 100000 -w 1000 rt
+bench -n 20 -w 2 reverse
+option benchcsv 1
+bench -n 20 -w 2 sort
+free
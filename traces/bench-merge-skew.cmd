@@ -0,0 +1,203 @@
+# Benchmark q_merge on one long queue followed by many short ones
+# Merging the two shortest queues first folds the short queues together
+# before they meet the long one, which is then traversed only once instead
+# of once per round of pairwise merging.
+option fail 0
+option malloc 0
+new
+ih RAND 400000
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+new
+ih RAND 8
+sort
+time merge
+free
@@ -0,0 +1,43 @@
+# Benchmark merge unique against merge followed by dedup on the same input:
+# eight sorted queues of Zipf words, so values repeat within and across them.
+# Taking a run at a time, the fused merge makes less than half the string
+# comparisons here, and frees duplicates as it meets them instead of walking
+# the result again.
+# 'time dedup' also includes the copy qtest makes to check the result.
+option fail 0
+option malloc 0
+option verify off
+option limitins 10000
+option limitsort 10000
+option limit 10000
+new
+it zipf:1.1,100000 50000
+sort
+new
+it zipf:1.1,100000 50000
+sort
+new
+it zipf:1.1,100000 50000
+sort
+new
+it zipf:1.1,100000 50000
+sort
+new
+it zipf:1.1,100000 50000
+sort
+new
+it zipf:1.1,100000 50000
+sort
+new
+it zipf:1.1,100000 50000
+sort
+new
+it zipf:1.1,100000 50000
+sort
+checkpoint
+time merge unique
+size
+restore
+time merge
+time dedup
+size
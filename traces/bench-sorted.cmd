@@ -0,0 +1,15 @@
+# Benchmark sorting a queue that is already known to be sorted
+# q_sort returns at once on the second call, and again after appending values
+# which are not below the tail, leaving only qtest's own walks over the queue;
+# reverse clears the flag and forces a full sort.
+option fail 0
+option malloc 0
+new
+ih RAND 500000
+time sort
+time sort
+it zzzzzzzzzzzz 1000
+time sort
+reverse
+time sort
+free
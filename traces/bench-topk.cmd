@@ -0,0 +1,12 @@
+# Benchmark partial sort and selection against a full sort
+# Extracting K << n smallest values is O(n log K) and should take a small
+# fraction of the time spent by sort on the same queue.
+option fail 0
+option malloc 0
+new
+ih RAND 500000
+time sortk 10
+time select 100
+time sortk 1000
+time sort
+free
@@ -0,0 +1,22 @@
+# Benchmark the checks made after each command; run with -v 3, since the
+# links are only checked when the queue is shown.  Sampled checks look at a
+# few windows of the queue, and async ones walk it on a second thread while
+# the next command works on another queue.
+option fail 0
+option malloc 0
+option limitsort 10000
+new
+ih RAND 500000
+option verify full
+time sort
+reverse
+option verify sampled
+time sort
+reverse
+option verify off
+time sort
+reverse
+option verify async
+time sort
+new
+time ih RAND 100000
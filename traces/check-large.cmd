@@ -0,0 +1,19 @@
+# The steps of bench-large.cmd at 2^20 elements, small enough for CI, which
+# runs this from 'make check'.  slotcheck checks the harness bookkeeping past
+# 2^32 blocks without allocating them; the 64-bit counts themselves are only
+# exercised by bench-large.cmd.
+slotcheck
+option poison off
+option compact 1
+option verify off
+new
+it seq: 1048576
+it zzz 10
+size
+find zzz 10
+rh 0000000000
+rt zzz
+size
+descend
+size
+free